@@ -0,0 +1,240 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+
+#include "wasmparser/instruction_decoder.h"
+#include "wasmparser/parse_workspace.h"
+#include "wasmparser/parser.h"
+#include "wasmparser/small_vector.h"
+
+// Counts the allocations made by parsing and decoding a module, and the
+// instructions copied instead of moved, so that regressions in either fail.
+// The allocation bounds leave some headroom over the current counts, while
+// no instruction may be copied at all.
+
+namespace {
+
+using wasmparser::Byte;
+using wasmparser::Bytes;
+using wasmparser::InstructionCopyCounter;
+
+size_t allocations = 0;
+size_t allocated_bytes = 0;
+
+constexpr size_t MAX_PARSE_ALLOCATIONS = 100;
+constexpr size_t MAX_PARSE_BYTES = 32 * 1024;
+constexpr size_t MAX_DECODE_ALLOCATIONS = 160;
+constexpr size_t MAX_DECODE_BYTES = 192 * 1024;
+constexpr size_t MAX_NESTED_PARSE_ALLOCATIONS = 40;
+constexpr size_t MAX_NESTED_PARSE_BYTES = 8 * 1024;
+constexpr size_t MAX_NESTED_DECODE_ALLOCATIONS = 480;
+constexpr size_t MAX_NESTED_DECODE_BYTES = 160 * 1024;
+// A workspace hands its vectors from one module to the next, so once it has
+// seen the module a few times, parsing it again allocates nothing.
+constexpr size_t WORKSPACE_WARMUP_PARSES = 4;
+
+struct Usage {
+  size_t allocations;
+  size_t bytes;
+  size_t copies;
+};
+
+void startCounting() {
+  allocations = 0;
+  allocated_bytes = 0;
+  InstructionCopyCounter::copies = 0;
+}
+
+Usage counted() {
+  return {allocations, allocated_bytes, InstructionCopyCounter::copies};
+}
+
+bool check(const char* what, const Usage& u, size_t max_n, size_t max_bytes) {
+  std::cout << what << ": " << u.allocations << " allocations, " << u.bytes
+            << " bytes, " << u.copies << " instructions ("
+            << u.copies * sizeof(wasmparser::Instruction)
+            << " bytes) copied" << std::endl;
+  bool ok = true;
+  if (u.allocations > max_n || u.bytes > max_bytes) {
+    std::cerr << what << " allocates more than " << max_n
+              << " times or more than " << max_bytes << " bytes" << std::endl;
+    ok = false;
+  }
+  if (u.copies != 0) {
+    std::cerr << what << " copies instructions" << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+void appendU32(uint32_t v, Bytes* out) {
+  do {
+    Byte b = v & 0x7F;
+    v >>= 7;
+    out->push_back(v != 0 ? b | 0x80 : b);
+  } while (v != 0);
+}
+
+void appendSection(Byte id, const Bytes& payload, Bytes* out) {
+  out->push_back(id);
+  appendU32(static_cast<uint32_t>(payload.size()), out);
+  out->insert(out->end(), payload.begin(), payload.end());
+}
+
+// Sections of a module whose functions of type [] -> [] nest blocks, loops
+// and both arms of ifs, so that every nested sequence is decoded.
+Bytes nestedBlocksSections() {
+  const Bytes nest = {
+      0x02, 0x40,              // block
+      0x03, 0x40,              // loop
+      0x41, 0x01, 0x04, 0x40,  // i32.const 1, if
+      0x02, 0x40,              // block
+      0x41, 0x00, 0x0D, 0x01,  // i32.const 0, br_if 1
+      0x01, 0x0B,              // nop, end
+      0x05,                    // else
+      0x41, 0x02, 0x1A,        // i32.const 2, drop
+      0x02, 0x40, 0x01, 0x0B,  // block, nop, end
+      0x0B,                    // end
+      0x41, 0x00, 0x0D, 0x00,  // i32.const 0, br_if 0
+      0x0B, 0x0B,              // end, end
+  };
+  constexpr uint32_t FUNCS = 4;
+  constexpr uint32_t NESTS_PER_FUNC = 8;
+  Bytes body = {0x00};
+  for (uint32_t i = 0; i < NESTS_PER_FUNC; ++i) {
+    body.insert(body.end(), nest.begin(), nest.end());
+  }
+  body.push_back(0x0B);
+
+  Bytes funcs = {FUNCS};
+  Bytes code = {FUNCS};
+  for (uint32_t i = 0; i < FUNCS; ++i) {
+    funcs.push_back(0x00);
+    appendU32(static_cast<uint32_t>(body.size()), &code);
+    code.insert(code.end(), body.begin(), body.end());
+  }
+  Bytes sections;
+  appendSection(0x01, {0x01, 0x60, 0x00, 0x00}, &sections);
+  appendSection(0x03, funcs, &sections);
+  appendSection(0x0A, code, &sections);
+  return sections;
+}
+
+}  // namespace
+
+// The array and nothrow forms call these by default.
+void* operator new(size_t size) {
+  ++allocations;
+  allocated_bytes += size;
+  if (void* p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+int main() {
+  startCounting();
+  wasmparser::Module m =
+      wasmparser::Parser::doParse(WASMPARSER_CPP_TESTDATA "/fibonacci.wasm");
+  Usage parse = counted();
+
+  startCounting();
+  wasmparser::InstructionDecoder d(&m);
+  Usage decode = counted();
+  if (d.cs_.empty()) {
+    std::cerr << "no function was decoded" << std::endl;
+    return 1;
+  }
+
+  auto nested_buf =
+      std::make_shared<wasmparser::ZeroCopyBuffer>(nestedBlocksSections());
+  wasmparser::Module nested;
+  startCounting();
+  if (!wasmparser::Parser::doParseSections(nested_buf, 8, &nested)) {
+    std::cerr << "the nested blocks module was not parsed" << std::endl;
+    return 1;
+  }
+  nested.buildIndexSpaces();
+  Usage nested_parse = counted();
+
+  startCounting();
+  wasmparser::InstructionDecoder nested_decoder(&nested);
+  Usage nested_decode = counted();
+  if (nested_decoder.cs_.size() != 4) {
+    std::cerr << "the nested blocks module was not decoded" << std::endl;
+    return 1;
+  }
+
+  // Vectors spilled out of their inline storage, e.g. long br_tables, must
+  // be counted as well.
+  allocations = 0;
+  {
+    wasmparser::SmallVector<uint32_t, 2> labels;
+    labels.resize(64);
+  }
+  if (allocations != 1) {
+    std::cerr << "a spilled SmallVector made " << allocations
+              << " counted allocations" << std::endl;
+    return 1;
+  }
+
+  // Copying must be counted, or the checks below pass vacuously.
+  startCounting();
+  {
+    wasmparser::Func copy = *d.cs_[0].code;
+  }
+  if (InstructionCopyCounter::copies < d.cs_[0].code->expr.size()) {
+    std::cerr << "copied instructions are not counted" << std::endl;
+    return 1;
+  }
+
+  wasmparser::ParseWorkspace workspace;
+  for (size_t i = 0; i < WORKSPACE_WARMUP_PARSES; ++i) {
+    workspace.parse(WASMPARSER_CPP_TESTDATA "/fibonacci.wasm");
+  }
+  startCounting();
+  workspace.parse(WASMPARSER_CPP_TESTDATA "/fibonacci.wasm");
+  Usage workspace_parse = counted();
+
+  bool ok = check("parse", parse, MAX_PARSE_ALLOCATIONS, MAX_PARSE_BYTES);
+  ok = check("decode", decode, MAX_DECODE_ALLOCATIONS, MAX_DECODE_BYTES) &&
+       ok;
+  ok = check("nested blocks parse", nested_parse,
+             MAX_NESTED_PARSE_ALLOCATIONS, MAX_NESTED_PARSE_BYTES) &&
+       ok;
+  ok = check("nested blocks decode", nested_decode,
+             MAX_NESTED_DECODE_ALLOCATIONS, MAX_NESTED_DECODE_BYTES) &&
+       ok;
+  ok = check("workspace parse", workspace_parse, 0, 0) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "wasmparser/call_graph.h"
+#include "wasmparser/instruction_decoder.h"
+#include "wasmparser/module_writer.h"
+#include "wasmparser/parser.h"
+
+// Dead functions must be stripped, and the written module must call the
+// remaining functions by their new indices.
+
+namespace {
+
+using wasmparser::Byte;
+using wasmparser::Bytes;
+using wasmparser::Instruction;
+
+void appendU32(uint32_t v, Bytes* out) {
+  do {
+    Byte b = v & 0x7F;
+    v >>= 7;
+    out->push_back(v != 0 ? b | 0x80 : b);
+  } while (v != 0);
+}
+
+void appendSection(Byte id, const Bytes& payload, Bytes* out) {
+  out->push_back(id);
+  appendU32(static_cast<uint32_t>(payload.size()), out);
+  out->insert(out->end(), payload.begin(), payload.end());
+}
+
+// Functions of type [] -> []: an imported one, 0, then the defined ones:
+// 1, exported, calls 3 and 0, 2 calls 4, 3 is a nop, and 4 is empty. 2 and
+// 4 are dead.
+Bytes sections() {
+  Bytes out;
+  appendSection(0x01, {0x01, 0x60, 0x00, 0x00}, &out);
+  appendSection(0x02, {0x01, 0x03, 'e', 'n', 'v', 0x01, 'f', 0x00, 0x00},
+                &out);
+  appendSection(0x03, {0x04, 0x00, 0x00, 0x00, 0x00}, &out);
+  appendSection(0x07, {0x01, 0x04, 'm', 'a', 'i', 'n', 0x00, 0x01}, &out);
+  appendSection(0x0A,
+                {0x04,                                      // 4 bodies
+                 0x06, 0x00, 0x10, 0x03, 0x10, 0x00, 0x0B,  // call 3, call 0
+                 0x04, 0x00, 0x10, 0x04, 0x0B,              // call 4
+                 0x03, 0x00, 0x01, 0x0B,                    // nop
+                 0x02, 0x00, 0x0B},                         // empty
+                &out);
+  return out;
+}
+
+bool parse(Bytes bytes, size_t offset, wasmparser::Module* m) {
+  if (!wasmparser::Parser::doParseSections(
+          std::make_shared<wasmparser::ZeroCopyBuffer>(std::move(bytes)),
+          offset, m)) {
+    return false;
+  }
+  m->buildIndexSpaces();
+  return true;
+}
+
+// Function indices called by `expr`, in order.
+std::vector<uint32_t> calls(const std::vector<Instruction>& expr) {
+  std::vector<uint32_t> out;
+  for (const auto& i : expr) {
+    if (i.type == wasmparser::InstructionType::Call) {
+      out.emplace_back(i.call_instruction.index);
+    }
+  }
+  return out;
+}
+
+}  // namespace
+
+int main() {
+  wasmparser::Module m;
+  if (!parse(sections(), 8, &m)) {
+    std::cerr << "failed to parse the module" << std::endl;
+    return 1;
+  }
+  wasmparser::InstructionDecoder d(&m);
+  auto removed = wasmparser::stripDeadFunctions(&m, &d);
+  if (removed != std::vector<uint32_t>{2, 4}) {
+    std::cerr << "functions 2 and 4 are not the stripped ones" << std::endl;
+    return 1;
+  }
+
+  // Parsed again without the module header.
+  Bytes written = wasmparser::ModuleWriter(&m, &d).write();
+  wasmparser::Module stripped;
+  if (written.size() < 8 ||
+      !parse(Bytes(written.begin() + 8, written.end()), 8, &stripped)) {
+    std::cerr << "failed to parse the stripped module" << std::endl;
+    return 1;
+  }
+  wasmparser::InstructionDecoder stripped_decoder(&stripped);
+  const auto& cs = stripped_decoder.cs_;
+  const auto& exports = stripped.export_sec.value;
+  bool ok = true;
+  if (cs.size() != 2 || stripped.func_sec.value.size() != 2) {
+    std::cerr << "the stripped module has " << cs.size() << " functions"
+              << std::endl;
+    return 1;
+  }
+  // 1 keeps its index, 3 becomes 2.
+  if (calls(cs[0].code->expr) != std::vector<uint32_t>{2, 0}) {
+    std::cerr << "the exported function calls the wrong functions"
+              << std::endl;
+    ok = false;
+  }
+  if (!calls(cs[1].code->expr).empty() || cs[1].code->expr.size() != 1) {
+    std::cerr << "the called function is not the nop one" << std::endl;
+    ok = false;
+  }
+  if (exports.size() != 1 || exports[0].desc.idx != 1) {
+    std::cerr << "the export does not name the exported function"
+              << std::endl;
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include "wasmparser/compressed_input.h"
+#include "wasmparser/parser.h"
+
+namespace {
+
+// Written to the working directory, which is the build tree under ctest.
+const char* const COMPRESSED_FILE = "compressed_input_test.wasm.gz";
+
+bool writeCompressed(const wasmparser::Bytes& module) {
+  gzFile out = gzopen(COMPRESSED_FILE, "wb");
+  if (out == nullptr) {
+    return false;
+  }
+  int written = gzwrite(out, module.data(), module.size());
+  return gzclose(out) == Z_OK &&
+         written == static_cast<int>(module.size());
+}
+
+// A compressed module must parse to the same module as the plain one.
+bool parsesLikePlain(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  wasmparser::Bytes module((std::istreambuf_iterator<char>(in)), {});
+  if (module.empty() || !writeCompressed(module)) {
+    std::cerr << "failed to compress " << filename << std::endl;
+    return false;
+  }
+  wasmparser::Module plain = wasmparser::Parser::doParse(filename);
+  wasmparser::Module compressed =
+      wasmparser::parseCompressedModule(COMPRESSED_FILE);
+  if (!(compressed == plain)) {
+    std::cerr << filename << " parses differently when compressed"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// A malformed module must surface as an exception of parseCompressedModule,
+// not terminate the process with the inflating thread still running, nor
+// allocate what its section sizes declare before the bytes arrive.
+bool rejects(const char* what, const wasmparser::Bytes& module) {
+  if (!writeCompressed(module)) {
+    std::cerr << "failed to write " << COMPRESSED_FILE << std::endl;
+    return false;
+  }
+  try {
+    wasmparser::parseCompressedModule(COMPRESSED_FILE);
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+  std::cerr << what << " was parsed" << std::endl;
+  return false;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = parsesLikePlain(WASMPARSER_CPP_TESTDATA "/fibonacci.wasm");
+  // A type section claiming 5 types in a 2-byte payload, which throws while
+  // it is parsed.
+  ok = rejects("a truncated type section",
+               {0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00, 0x01, 0x02,
+                0x05, 0x60}) &&
+       ok;
+  // A type section declaring 4 GiB of payload but ending after a byte.
+  ok = rejects("a section shorter than its size",
+               {0x00, 0x61, 0x73, 0x6D, 0x01, 0x00, 0x00, 0x00, 0x01, 0xFF,
+                0xFF, 0xFF, 0xFF, 0x0F, 0x01}) &&
+       ok;
+  std::remove(COMPRESSED_FILE);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "wasmparser/instruction_decoder.h"
+#include "wasmparser/parser.h"
+
+// Truncated and overlong function bodies must be rejected without reading
+// past the code section, and nesting must stay within MAX_BLOCK_DEPTH.
+
+namespace {
+
+using wasmparser::Byte;
+using wasmparser::Bytes;
+
+void appendU32(uint32_t v, Bytes* out) {
+  do {
+    Byte b = v & 0x7F;
+    v >>= 7;
+    out->push_back(v != 0 ? b | 0x80 : b);
+  } while (v != 0);
+}
+
+void appendSection(Byte id, const Bytes& payload, Bytes* out) {
+  out->push_back(id);
+  appendU32(static_cast<uint32_t>(payload.size()), out);
+  out->insert(out->end(), payload.begin(), payload.end());
+}
+
+// Decodes a module with one function of type [] -> [] whose body is `body`.
+// Nesting is only limited by MAX_BLOCK_DEPTH.
+bool decodes(const Bytes& body) {
+  Bytes sections;
+  appendSection(0x01, {0x01, 0x60, 0x00, 0x00}, &sections);
+  appendSection(0x03, {0x01, 0x00}, &sections);
+  Bytes code = {0x01};
+  appendU32(static_cast<uint32_t>(body.size()), &code);
+  code.insert(code.end(), body.begin(), body.end());
+  appendSection(0x0A, code, &sections);
+  try {
+    wasmparser::Module m;
+    if (!wasmparser::Parser::doParseSections(
+            std::make_shared<wasmparser::ZeroCopyBuffer>(std::move(sections)),
+            8, &m)) {
+      return false;
+    }
+    m.buildIndexSpaces();
+    wasmparser::DecoderOptions options;
+    options.max_block_depth = std::numeric_limits<uint32_t>::max();
+    wasmparser::InstructionDecoder d(&m, options);
+    return d.cs_.size() == 1;
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+}
+
+Bytes nestedBlocks(uint32_t depth) {
+  Bytes body = {0x00};
+  for (uint32_t i = 0; i < depth; ++i) {
+    body.insert(body.end(), {0x02, 0x40});
+  }
+  body.insert(body.end(), depth + 1, 0x0B);
+  return body;
+}
+
+}  // namespace
+
+int main() {
+  struct Case {
+    const char* name;
+    Bytes body;
+    bool valid;
+  };
+  const Case cases[] = {
+      {"empty body", {0x00, 0x0B}, true},
+      {"i32.const", {0x00, 0x41, 0x7F, 0x1A, 0x0B}, true},
+      {"unterminated i32.const", {0x00, 0x41, 0x80, 0x80, 0x80}, false},
+      {"overlong i32.const",
+       {0x00, 0x41, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x1A, 0x0B},
+       false},
+      {"locals count without locals", {0x05}, false},
+      {"truncated local.get", {0x00, 0x20}, false},
+      {"truncated i64.load", {0x00, 0x29, 0x03}, false},
+      {"missing end", {0x00, 0x01}, false},
+      {"i8x16.extract_lane_s",
+       {0x00, 0xFD, 0x0C, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0xFD, 0x15, 0x00, 0x1A, 0x0B},
+       true},
+      {"truncated extract_lane lane", {0x00, 0xFD, 0x15}, false},
+      {"truncated v128.const", {0x00, 0xFD, 0x0C, 0x01, 0x02}, false},
+      {"truncated i8x16.shuffle", {0x00, 0xFD, 0x0D, 0x01}, false},
+      {"maximum nesting", nestedBlocks(wasmparser::MAX_BLOCK_DEPTH), true},
+      {"nesting too deep", nestedBlocks(wasmparser::MAX_BLOCK_DEPTH + 1),
+       false},
+  };
+  bool ok = true;
+  for (const auto& c : cases) {
+    if (decodes(c.body) != c.valid) {
+      std::cerr << c.name << ": expected the body to be "
+                << (c.valid ? "accepted" : "rejected") << std::endl;
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,304 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "wasmparser/instruction_decoder.h"
+#include "wasmparser/parser.h"
+#include "wasmparser/peephole.h"
+
+// Constants must be folded as wasm computes them, trapping operations must
+// be kept, and the peephole rewrites must only apply where they are
+// equivalent.
+
+namespace {
+
+using wasmparser::Byte;
+using wasmparser::Bytes;
+using wasmparser::Instruction;
+using wasmparser::InstructionType;
+using wasmparser::PeepholeStats;
+
+void appendU32(uint32_t v, Bytes* out) {
+  do {
+    Byte b = v & 0x7F;
+    v >>= 7;
+    out->push_back(v != 0 ? b | 0x80 : b);
+  } while (v != 0);
+}
+
+void appendSection(Byte id, const Bytes& payload, Bytes* out) {
+  out->push_back(id);
+  appendU32(static_cast<uint32_t>(payload.size()), out);
+  out->insert(out->end(), payload.begin(), payload.end());
+}
+
+// Decodes `instrs` as the body of a function of type [] -> [] with two i32
+// locals, and optimizes it.
+std::vector<Instruction> optimized(const Bytes& instrs, PeepholeStats* stats) {
+  Bytes body = {0x01, 0x02, 0x7F};
+  body.insert(body.end(), instrs.begin(), instrs.end());
+  body.push_back(0x0B);
+  Bytes sections;
+  appendSection(0x01, {0x01, 0x60, 0x00, 0x00}, &sections);
+  appendSection(0x03, {0x01, 0x00}, &sections);
+  Bytes code = {0x01};
+  appendU32(static_cast<uint32_t>(body.size()), &code);
+  code.insert(code.end(), body.begin(), body.end());
+  appendSection(0x0A, code, &sections);
+
+  wasmparser::Module m;
+  if (!wasmparser::Parser::doParseSections(
+          std::make_shared<wasmparser::ZeroCopyBuffer>(std::move(sections)),
+          8, &m)) {
+    return {};
+  }
+  m.buildIndexSpaces();
+  wasmparser::InstructionDecoder d(&m);
+  wasmparser::Func f = *d.cs_[0].code;
+  wasmparser::PeepholeOptimizer optimizer(&m);
+  optimizer.optimize(&f);
+  *stats = optimizer.stats();
+  return f.expr;
+}
+
+bool isI32Const(const Instruction& i, int32_t v) {
+  return i.type == InstructionType::NumericConst &&
+         i.numeric_const_instruction.type ==
+             wasmparser::NumericConstInstruction::Type::I32_CONST &&
+         i.numeric_const_instruction.i32_value == v;
+}
+
+bool isI64Const(const Instruction& i, int64_t v) {
+  return i.type == InstructionType::NumericConst &&
+         i.numeric_const_instruction.type ==
+             wasmparser::NumericConstInstruction::Type::I64_CONST &&
+         i.numeric_const_instruction.i64_value == v;
+}
+
+bool isNumeric(const Instruction& i, Byte op) {
+  return i.type == InstructionType::Numeric &&
+         static_cast<Byte>(i.numeric_instruction.type) == op;
+}
+
+bool isVariable(const Instruction& i, Byte op, uint32_t idx) {
+  return i.type == InstructionType::Variable &&
+         static_cast<Byte>(i.variable_instruction.type) == op &&
+         i.variable_instruction.idx == idx;
+}
+
+// `instrs` followed by drop must fold into `value` followed by drop.
+bool foldsToI32(const char* what, const Bytes& instrs, int32_t value) {
+  Bytes body = instrs;
+  body.push_back(0x1A);
+  PeepholeStats stats;
+  auto out = optimized(body, &stats);
+  if (out.size() != 2 || !isI32Const(out[0], value) ||
+      stats.folded_consts == 0) {
+    std::cerr << what << " is not folded into " << value << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool foldsToI64(const char* what, const Bytes& instrs, int64_t value) {
+  Bytes body = instrs;
+  body.push_back(0x1A);
+  PeepholeStats stats;
+  auto out = optimized(body, &stats);
+  if (out.size() != 2 || !isI64Const(out[0], value) ||
+      stats.folded_consts == 0) {
+    std::cerr << what << " is not folded into " << value << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// `instrs` would trap, so they must be kept as they are.
+bool keeps(const char* what, const Bytes& instrs, Byte op) {
+  Bytes body = instrs;
+  body.push_back(0x1A);
+  PeepholeStats stats;
+  auto out = optimized(body, &stats);
+  if (out.size() != 4 || !isNumeric(out[2], op) || stats.total() != 0) {
+    std::cerr << what << " is folded although it traps" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Operands of the folding tests, as i32.const and i64.const instructions.
+const Bytes I32_MIN = {0x41, 0x80, 0x80, 0x80, 0x80, 0x78};
+const Bytes I32_MINUS_ONE = {0x41, 0x7F};
+
+Bytes cat(std::initializer_list<Bytes> parts) {
+  Bytes out;
+  for (const auto& p : parts) {
+    out.insert(out.end(), p.begin(), p.end());
+  }
+  return out;
+}
+
+bool folding() {
+  bool ok = true;
+  ok = foldsToI32("7 - 5", {0x41, 0x07, 0x41, 0x05, 0x6B}, 2) && ok;
+  ok = foldsToI32("(1 + 2) * 3",
+                  {0x41, 0x01, 0x41, 0x02, 0x6A, 0x41, 0x03, 0x6C}, 9) &&
+       ok;
+  ok = foldsToI32("INT_MIN rem_s -1", cat({I32_MIN, I32_MINUS_ONE, {0x6F}}),
+                  0) &&
+       ok;
+  ok = foldsToI32("-7 div_s 2", {0x41, 0x79, 0x41, 0x02, 0x6D}, -3) && ok;
+  ok = foldsToI32("-1 div_u 2", cat({I32_MINUS_ONE, {0x41, 0x02, 0x6E}}),
+                  INT32_MAX) &&
+       ok;
+  // Shift and rotate counts are taken modulo the operand width.
+  ok = foldsToI32("1 shl 33", {0x41, 0x01, 0x41, 0x21, 0x74}, 2) && ok;
+  ok = foldsToI32("INT_MIN shr_s 31", cat({I32_MIN, {0x41, 0x1F, 0x75}}),
+                  -1) &&
+       ok;
+  ok = foldsToI32("INT_MIN shr_u 63", cat({I32_MIN, {0x41, 0x3F, 0x76}}),
+                  1) &&
+       ok;
+  ok = foldsToI32("INT_MIN + 1 rotl 1",
+                  {0x41, 0x81, 0x80, 0x80, 0x80, 0x78, 0x41, 0x01, 0x77}, 3) &&
+       ok;
+  ok = foldsToI32("5 rotr 32", {0x41, 0x05, 0x41, 0x20, 0x78}, 5) && ok;
+  ok = foldsToI32("5 rotr 1", {0x41, 0x05, 0x41, 0x01, 0x78},
+                  static_cast<int32_t>(0x80000002u)) &&
+       ok;
+  ok = foldsToI64("-8 shr_s 65", {0x42, 0x78, 0x42, 0xC1, 0x00, 0x87}, -4) &&
+       ok;
+  ok = foldsToI64("1 rotl 64", {0x42, 0x01, 0x42, 0xC0, 0x00, 0x89}, 1) && ok;
+  ok = foldsToI32("3 lt_s -1", cat({{0x41, 0x03}, I32_MINUS_ONE, {0x48}}),
+                  0) &&
+       ok;
+  ok = foldsToI32("clz 1", {0x41, 0x01, 0x67}, 31) && ok;
+  ok = foldsToI64("extend_i32_s -1", cat({I32_MINUS_ONE, {0xAC}}), -1) && ok;
+  ok = foldsToI64("extend_i32_u -1", cat({I32_MINUS_ONE, {0xAD}}),
+                  INT64_C(0xFFFFFFFF)) &&
+       ok;
+
+  ok = keeps("INT_MIN div_s -1", cat({I32_MIN, I32_MINUS_ONE, {0x6D}}),
+             0x6D) &&
+       ok;
+  ok = keeps("1 div_s 0", {0x41, 0x01, 0x41, 0x00, 0x6D}, 0x6D) && ok;
+  ok = keeps("1 div_u 0", {0x41, 0x01, 0x41, 0x00, 0x6E}, 0x6E) && ok;
+  ok = keeps("1 rem_s 0", {0x41, 0x01, 0x41, 0x00, 0x6F}, 0x6F) && ok;
+  ok = keeps("1 rem_u 0", {0x41, 0x01, 0x41, 0x00, 0x70}, 0x70) && ok;
+  ok = keeps("i64 1 div_s 0", {0x42, 0x01, 0x42, 0x00, 0x7F}, 0x7F) && ok;
+  ok = keeps("i64 1 rem_u 0", {0x42, 0x01, 0x42, 0x00, 0x82}, 0x82) && ok;
+  return ok;
+}
+
+bool localTees() {
+  bool ok = true;
+  PeepholeStats stats;
+  // i32.const 1, local.set 0, local.get 0, drop
+  auto out = optimized({0x41, 0x01, 0x21, 0x00, 0x20, 0x00, 0x1A}, &stats);
+  if (out.size() != 3 || !isVariable(out[1], 0x22, 0) ||
+      stats.local_tees != 1) {
+    std::cerr << "local.set 0, local.get 0 is not turned into local.tee 0"
+              << std::endl;
+    ok = false;
+  }
+  // i32.const 1, local.set 0, local.get 1, drop
+  out = optimized({0x41, 0x01, 0x21, 0x00, 0x20, 0x01, 0x1A}, &stats);
+  if (out.size() != 4 || !isVariable(out[1], 0x21, 0) ||
+      !isVariable(out[2], 0x20, 1) || stats.total() != 0) {
+    std::cerr << "local.set 0, local.get 1 is rewritten" << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+bool nops() {
+  PeepholeStats stats;
+  auto out = optimized({0x01, 0x41, 0x01, 0x01, 0x1A, 0x01}, &stats);
+  if (out.size() != 2 || stats.removed_nops != 3) {
+    std::cerr << "nops are not removed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Instructions of the only block of `out`, or nullptr.
+const std::vector<Instruction>* blockBody(
+    const std::vector<Instruction>& out) {
+  if (out.empty() || out[0].type != InstructionType::Block) {
+    return nullptr;
+  }
+  return &out[0].block_instruction.instructions;
+}
+
+bool trailingBranches() {
+  bool ok = true;
+  PeepholeStats stats;
+  // block (result i32), i32.const 1, br 0, end, drop
+  auto out = optimized({0x02, 0x7F, 0x41, 0x01, 0x0C, 0x00, 0x0B, 0x1A},
+                       &stats);
+  auto* body = blockBody(out);
+  if (body == nullptr || body->size() != 1 || stats.removed_branches != 1) {
+    std::cerr << "br 0 at the end of a block is not removed" << std::endl;
+    ok = false;
+  }
+  // block (result i32), i32.const 1, i32.const 2, br 0, end, drop: br 0
+  // drops the 1, falling through would not.
+  out = optimized(
+      {0x02, 0x7F, 0x41, 0x01, 0x41, 0x02, 0x0C, 0x00, 0x0B, 0x1A}, &stats);
+  body = blockBody(out);
+  if (body == nullptr || body->size() != 3 || stats.removed_branches != 0) {
+    std::cerr << "br 0 above the block results is removed" << std::endl;
+    ok = false;
+  }
+  // block, br 1, end: not a branch to the following end.
+  out = optimized({0x02, 0x40, 0x0C, 0x01, 0x0B}, &stats);
+  body = blockBody(out);
+  if (body == nullptr || body->size() != 1 || stats.removed_branches != 0) {
+    std::cerr << "br 1 at the end of a block is removed" << std::endl;
+    ok = false;
+  }
+  // loop, br 0, end: br 0 jumps back to the start of the loop.
+  out = optimized({0x03, 0x40, 0x0C, 0x00, 0x0B}, &stats);
+  body = blockBody(out);
+  if (body == nullptr || body->size() != 1 || stats.removed_branches != 0) {
+    std::cerr << "br 0 at the end of a loop is removed" << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = folding();
+  ok = localTees() && ok;
+  ok = nops() && ok;
+  ok = trailingBranches() && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "wasmparser/instruction_decoder.h"
+#include "wasmparser/module_writer.h"
+#include "wasmparser/parser.h"
+
+// An unmodified module must be written back byte for byte, in memory and to
+// a file.
+
+namespace {
+
+// Written to the working directory, which is the build tree under ctest.
+const char* const OUTPUT_FILE = "round_trip_test.wasm";
+
+wasmparser::Bytes readFile(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  return wasmparser::Bytes((std::istreambuf_iterator<char>(in)), {});
+}
+
+bool roundTrips(const std::string& filename) {
+  wasmparser::Bytes module = readFile(filename);
+  if (module.empty()) {
+    std::cerr << "failed to read " << filename << std::endl;
+    return false;
+  }
+  wasmparser::Module m = wasmparser::Parser::doParse(filename);
+  wasmparser::InstructionDecoder d(&m);
+  wasmparser::ModuleWriter writer(&m, &d);
+  bool ok = true;
+  if (writer.write() != module) {
+    std::cerr << filename << " is not written back unchanged" << std::endl;
+    ok = false;
+  }
+  writer.writeFile(OUTPUT_FILE);
+  if (readFile(OUTPUT_FILE) != module) {
+    std::cerr << filename << " is not written back unchanged to a file"
+              << std::endl;
+    ok = false;
+  }
+  std::remove(OUTPUT_FILE);
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  return roundTrips(WASMPARSER_CPP_TESTDATA "/fibonacci.wasm") ? 0 : 1;
+}
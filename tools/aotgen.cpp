@@ -0,0 +1,60 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <fstream>
+#include <iostream>
+
+#include "wasmparser/aot_emitter.h"
+#include "wasmparser/instruction_decoder.h"
+#include "wasmparser/parser.h"
+
+// Usage: wasmparser_aotgen <input.wasm> <output.cpp> <symbol>
+//
+// Decodes <input.wasm> and writes a translation unit which defines
+// `const wasmparser::AotModule <symbol>`. Declare it where it is used as
+//
+//   extern const wasmparser::AotModule <symbol>;
+int main(int argc, char** argv) {
+  if (argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <input.wasm> <output.cpp> <symbol>"
+              << std::endl;
+    return 1;
+  }
+  try {
+    auto mod = wasmparser::Parser::doParse(argv[1]);
+    wasmparser::InstructionDecoder decoder(&mod);
+    wasmparser::AotEmitter emitter(&mod, &decoder);
+    std::ofstream out(argv[2], std::ios::out | std::ios::trunc);
+    if (!out) {
+      std::cerr << "Failed to open " << argv[2] << std::endl;
+      return 1;
+    }
+    emitter.emit(out, argv[3]);
+  } catch (const std::exception& e) {
+    std::cerr << argv[1] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
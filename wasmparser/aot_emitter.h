@@ -0,0 +1,372 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_AOT_EMITTER_H
+#define WASMPARSER_CPP_AOT_EMITTER_H
+
+#include <cstring>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "aot_module.h"
+#include "instruction_decoder.h"
+#include "module.h"
+
+namespace wasmparser {
+
+// Writes a decoded module as a C++ translation unit which defines an
+// AotModule, see aot_module.h.
+class AotEmitter {
+ public:
+  AotEmitter(const Module* m, const InstructionDecoder* decoder);
+
+  void emit(std::ostream& os, std::string_view symbol) const;
+
+ private:
+  AotName addName(const Name& name);
+  void addFunction(const Func& f);
+  void flatten(const std::vector<Instruction>& iseq);
+  AotInstruction flattenOne(const Instruction& i);
+
+  std::vector<ValueType> value_types_;
+  std::vector<char> names_;
+  std::vector<AotFuncType> types_;
+  std::vector<AotImport> imports_;
+  std::vector<AotExport> exports_;
+  std::vector<uint32_t> func_types_;
+  uint32_t imported_func_count_{0};
+  std::vector<AotFunction> functions_;
+  std::vector<AotLocal> locals_;
+  std::vector<AotInstruction> instructions_;
+  std::vector<uint32_t> labels_;
+  std::vector<V128> v128s_;
+};
+
+AotEmitter::AotEmitter(const Module* m, const InstructionDecoder* decoder) {
+  for (const auto& ft : m->type_sec.value) {
+    AotFuncType t;
+    t.param_offset = value_types_.size();
+    t.param_count = ft.param_type.size();
+    value_types_.insert(value_types_.end(), ft.param_type.begin(),
+                        ft.param_type.end());
+    t.result_offset = value_types_.size();
+    t.result_count = ft.return_type.size();
+    value_types_.insert(value_types_.end(), ft.return_type.begin(),
+                        ft.return_type.end());
+    types_.emplace_back(t);
+  }
+  for (const auto& ip : m->import_sec.value) {
+    AotImport a{};
+    a.module_name = addName(ip.module_name);
+    a.name = addName(ip.name);
+    a.kind = static_cast<Byte>(ip.desc.index());
+    auto setLimit = [&a](const Limit& l) {
+      a.min = l.min_;
+      a.has_max = l.max_.has_value();
+      a.shared = l.shared;
+      a.max = l.max_.value_or(0);
+    };
+    if (auto* ti = std::get_if<Import::TypeIdxImportDesc>(&ip.desc)) {
+      a.type = ti->value;
+    } else if (auto* tt = std::get_if<Import::TableTypeImportDesc>(&ip.desc)) {
+      a.type = tt->value.elem_type;
+      setLimit(tt->value.limit);
+    } else if (auto* mt = std::get_if<Import::MemTypeImportDesc>(&ip.desc)) {
+      a.type = static_cast<uint32_t>(mt->value.indexType());
+      setLimit(mt->value.limit);
+    } else if (auto* gt = std::get_if<Import::GlobalTypeImportDesc>(&ip.desc)) {
+      a.type = static_cast<uint32_t>(gt->value.val_type);
+      a.min = static_cast<uint32_t>(gt->value.mut);
+    }
+    imports_.emplace_back(a);
+  }
+  for (const auto& e : m->export_sec.value) {
+    AotExport a;
+    a.name = addName(e.name);
+    a.kind = static_cast<Byte>(e.desc.type);
+    a.idx = e.desc.idx;
+    exports_.emplace_back(a);
+  }
+  func_types_ = m->func_space.entries;
+  imported_func_count_ = m->func_space.imported;
+  for (const auto& c : decoder->cs_) {
+    addFunction(*c.code);
+  }
+}
+
+AotName AotEmitter::addName(const Name& name) {
+  AotName n;
+  n.offset = names_.size();
+  n.size = name.size();
+  names_.insert(names_.end(), name.begin(), name.end());
+  return n;
+}
+
+void AotEmitter::addFunction(const Func& f) {
+  AotFunction af;
+  af.local_offset = locals_.size();
+  af.local_count = f.locals.size();
+  for (const auto& l : f.locals) {
+    locals_.emplace_back(AotLocal{l.n, l.t});
+  }
+  af.code_offset = instructions_.size();
+  flatten(f.expr);
+  af.code_count = instructions_.size() - af.code_offset;
+  af.max_stack_height = f.frame.max_stack_height;
+  af.locals_size = f.frame.locals_size;
+  functions_.emplace_back(af);
+}
+
+void AotEmitter::flatten(const std::vector<Instruction>& iseq) {
+  for (const auto& i : iseq) {
+    if (i.type != InstructionType::Block) {
+      instructions_.emplace_back(flattenOne(i));
+      continue;
+    }
+    // Blocks are patched once the positions of their branches are known.
+    size_t pos = instructions_.size();
+    instructions_.emplace_back(flattenOne(i));
+    flatten(i.block_instruction.instructions);
+    instructions_[pos].a = instructions_.size();
+    flatten(i.block_instruction.else_instructions);
+    instructions_[pos].b = instructions_.size();
+  }
+}
+
+AotInstruction AotEmitter::flattenOne(const Instruction& i) {
+  AotInstruction a{};
+  a.type = i.type;
+  switch (i.type) {
+    case InstructionType::SingleOperandControl:
+      a.opcode = static_cast<uint32_t>(
+          i.single_operand_control_instruction.type);
+      break;
+    case InstructionType::Block: {
+      const auto& bi = i.block_instruction;
+      a.opcode = static_cast<uint32_t>(bi.type);
+      int64_t block_type = -64;
+      if (bi.block_type == BlockInstruction::BlockType::ValueType) {
+        block_type = static_cast<int64_t>(bi.value_type) - 0x80;
+      } else if (bi.block_type == BlockInstruction::BlockType::TypeIndex) {
+        block_type = bi.type_idx;
+      }
+      a.c = static_cast<uint64_t>(block_type);
+      break;
+    }
+    case InstructionType::Branch:
+      a.opcode = static_cast<uint32_t>(i.branch_instruction.type);
+      a.a = i.branch_instruction.index;
+      break;
+    case InstructionType::TableBranch:
+      a.opcode = 0x0E;
+      a.a = labels_.size();
+      a.b = i.table_branch_instruction.l.size();
+      a.c = i.table_branch_instruction.ln;
+      labels_.insert(labels_.end(), i.table_branch_instruction.l.begin(),
+                     i.table_branch_instruction.l.end());
+      break;
+    case InstructionType::Call:
+      a.opcode = static_cast<uint32_t>(i.call_instruction.type);
+      a.a = i.call_instruction.index;
+      break;
+    case InstructionType::Parametric:
+      a.opcode = static_cast<uint32_t>(i.parametric_instruction.type);
+      break;
+    case InstructionType::Variable:
+      a.opcode = static_cast<uint32_t>(i.variable_instruction.type);
+      a.a = i.variable_instruction.idx;
+      break;
+    case InstructionType::BasicMemory:
+      a.opcode = static_cast<uint32_t>(i.basic_memory_instruction.type);
+      a.a = i.basic_memory_instruction.arg.align;
+      a.c = i.basic_memory_instruction.arg.offset;
+      break;
+    case InstructionType::MemorySize:
+      a.opcode = static_cast<uint32_t>(i.memory_size_instruction.type);
+      break;
+    case InstructionType::Numeric:
+      a.opcode = static_cast<uint32_t>(i.numeric_instruction.type);
+      break;
+    case InstructionType::NumericConst: {
+      const auto& nci = i.numeric_const_instruction;
+      a.opcode = static_cast<uint32_t>(nci.type);
+      if (nci.type == NumericConstInstruction::Type::I32_CONST ||
+          nci.type == NumericConstInstruction::Type::F32_CONST) {
+        uint32_t bits;
+        std::memcpy(&bits, &nci.i32_value, sizeof(bits));
+        a.c = bits;
+      } else {
+        std::memcpy(&a.c, &nci.i64_value, sizeof(a.c));
+      }
+      break;
+    }
+    case InstructionType::Simd:
+      a.opcode = static_cast<uint32_t>(i.simd_instruction.type);
+      a.a = i.simd_instruction.arg.align;
+      a.b = i.simd_instruction.lane;
+      a.c = i.simd_instruction.arg.offset;
+      break;
+    case InstructionType::SimdConst:
+      a.opcode = 0x0C;
+      a.a = v128s_.size();
+      v128s_.emplace_back(i.simd_const_instruction.value);
+      break;
+    case InstructionType::SimdShuffle:
+      a.opcode = 0x0D;
+      a.a = v128s_.size();
+      v128s_.emplace_back(i.simd_shuffle_instruction.lanes);
+      break;
+    case InstructionType::SaturatingTruncation:
+      a.opcode =
+          static_cast<uint32_t>(i.saturating_truncation_instruction.type);
+      break;
+    case InstructionType::BulkMemory:
+      a.opcode = static_cast<uint32_t>(i.bulk_memory_instruction.type);
+      a.a = i.bulk_memory_instruction.segment_idx;
+      a.b = i.bulk_memory_instruction.dst_idx;
+      a.c = i.bulk_memory_instruction.src_idx;
+      break;
+    case InstructionType::Atomic:
+      a.opcode = static_cast<uint32_t>(i.atomic_instruction.type);
+      a.a = i.atomic_instruction.arg.align;
+      a.c = i.atomic_instruction.arg.offset;
+      break;
+  }
+  return a;
+}
+
+namespace {
+
+// Writes `name` as an array definition. Arrays can't be empty, so an empty
+// table gets a single zeroed entry which is never referenced.
+template <class T, class F>
+void emitArray(std::ostream& os, const char* type, const char* name,
+               const std::vector<T>& values, F emitValue) {
+  os << "const " << type << " " << name << "[] = {\n";
+  if (values.empty()) {
+    os << "    {},\n";
+  }
+  for (const auto& v : values) {
+    os << "    ";
+    emitValue(v);
+    os << ",\n";
+  }
+  os << "};\n\n";
+}
+
+}  // namespace
+
+void AotEmitter::emit(std::ostream& os, std::string_view symbol) const {
+  os << "// Generated by wasmparser_aotgen. Do not edit.\n\n"
+     << "#include \"wasmparser/aot_module.h\"\n\n"
+     << "namespace {\n\n"
+     << "using namespace wasmparser;\n\n";
+
+  emitArray(os, "ValueType", "kValueTypes", value_types_, [&os](ValueType v) {
+    os << "static_cast<ValueType>(" << static_cast<uint32_t>(v) << ")";
+  });
+
+  // Names are written as octal escapes, because they are arbitrary bytes.
+  os << "const char kNames[] =\n    \"";
+  for (size_t i = 0; i < names_.size(); ++i) {
+    if (i > 0 && i % 16 == 0) {
+      os << "\"\n    \"";
+    }
+    auto c = static_cast<unsigned char>(names_[i]);
+    os << '\\' << static_cast<char>('0' + ((c >> 6) & 7))
+       << static_cast<char>('0' + ((c >> 3) & 7))
+       << static_cast<char>('0' + (c & 7));
+  }
+  os << "\";\n\n";
+
+  emitArray(os, "AotFuncType", "kTypes", types_, [&os](const AotFuncType& t) {
+    os << "{" << t.param_offset << ", " << t.param_count << ", "
+       << t.result_offset << ", " << t.result_count << "}";
+  });
+  emitArray(os, "AotImport", "kImports", imports_, [&os](const AotImport& a) {
+    os << "{{" << a.module_name.offset << ", " << a.module_name.size
+       << "}, {" << a.name.offset << ", " << a.name.size << "}, "
+       << static_cast<uint32_t>(a.kind) << ", " << a.type << ", " << a.min
+       << "u, " << a.max << "u, " << (a.has_max ? "true" : "false") << ", "
+       << (a.shared ? "true" : "false") << "}";
+  });
+  emitArray(os, "AotExport", "kExports", exports_, [&os](const AotExport& a) {
+    os << "{{" << a.name.offset << ", " << a.name.size << "}, "
+       << static_cast<uint32_t>(a.kind) << ", " << a.idx << "}";
+  });
+  emitArray(os, "uint32_t", "kFuncTypes", func_types_,
+            [&os](uint32_t t) { os << t; });
+  emitArray(os, "AotFunction", "kFunctions", functions_,
+            [&os](const AotFunction& f) {
+              os << "{" << f.local_offset << ", " << f.local_count << ", "
+                 << f.code_offset << ", " << f.code_count << ", "
+                 << f.max_stack_height << ", " << f.locals_size << "u}";
+            });
+  emitArray(os, "AotLocal", "kLocals", locals_, [&os](const AotLocal& l) {
+    os << "{" << l.n << ", static_cast<ValueType>("
+       << static_cast<uint32_t>(l.t) << ")}";
+  });
+  emitArray(os, "AotInstruction", "kInstructions", instructions_,
+            [&os](const AotInstruction& i) {
+              os << "{static_cast<InstructionType>("
+                 << static_cast<uint32_t>(i.type) << "), " << i.opcode << ", "
+                 << i.a << ", " << i.b << ", " << i.c << "u}";
+            });
+  emitArray(os, "uint32_t", "kLabels", labels_, [&os](uint32_t l) { os << l; });
+  emitArray(os, "V128", "kV128s", v128s_, [&os](const V128& v) {
+    os << "{";
+    for (size_t i = 0; i < v.size(); ++i) {
+      os << (i > 0 ? ", " : "") << static_cast<uint32_t>(v[i]);
+    }
+    os << "}";
+  });
+
+  os << "}  // namespace\n\n"
+     << "extern const wasmparser::AotModule " << symbol << ";\n"
+     << "const wasmparser::AotModule " << symbol << " = {\n"
+     << "    kValueTypes,\n"
+     << "    kNames,\n"
+     << "    kTypes,\n"
+     << "    " << types_.size() << ",\n"
+     << "    kImports,\n"
+     << "    " << imports_.size() << ",\n"
+     << "    kExports,\n"
+     << "    " << exports_.size() << ",\n"
+     << "    kFuncTypes,\n"
+     << "    " << func_types_.size() << ",\n"
+     << "    " << imported_func_count_ << ",\n"
+     << "    kFunctions,\n"
+     << "    kLocals,\n"
+     << "    kInstructions,\n"
+     << "    " << instructions_.size() << ",\n"
+     << "    kLabels,\n"
+     << "    kV128s,\n"
+     << "};\n";
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_AOT_EMITTER_H
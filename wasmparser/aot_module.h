@@ -0,0 +1,150 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_AOT_MODULE_H
+#define WASMPARSER_CPP_AOT_MODULE_H
+
+#include <cstdint>
+
+#include "instructions.h"
+#include "types.h"
+
+namespace wasmparser {
+
+// Tables of a module which has been decoded ahead of time by
+// wasmparser_aotgen. The generated tables are constant-initialized arrays,
+// and entries refer to each other by position instead of by pointer, so
+// everything apart from AotModule itself lands in read-only data without
+// relocations.
+
+struct AotFuncType {
+  // Ranges in AotModule::value_types.
+  uint32_t param_offset;
+  uint32_t param_count;
+  uint32_t result_offset;
+  uint32_t result_count;
+};
+
+struct AotName {
+  // Range in AotModule::names.
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct AotImport {
+  AotName module_name;
+  AotName name;
+  // Import description tag, 0x00 (func) to 0x03 (global).
+  Byte kind;
+  // Type index for functions, element type for tables, index value type
+  // for memories, value type for globals.
+  uint32_t type;
+  // Limits of tables and memories, mutability of globals.
+  uint64_t min;
+  uint64_t max;
+  bool has_max;
+  bool shared;
+};
+
+struct AotExport {
+  AotName name;
+  // Export description tag, 0x00 (func) to 0x03 (global).
+  Byte kind;
+  uint32_t idx;
+};
+
+// Instructions are stored in pre-order. The instructions of a block follow
+// the block instruction, with the else branch after the then branch.
+//
+// Operands by instruction type:
+//   Block:        a = start of the else branch, b = end of the block,
+//                 c = block type as its s33 encoding (-64 for empty, a
+//                 negative value type byte, or a type index).
+//   Branch:       a = label index.
+//   TableBranch:  a = first label in AotModule::labels, b = label count,
+//                 c = default label.
+//   Call:         a = function or type index.
+//   Variable:     a = local or global index.
+//   BasicMemory:  a = alignment, c = offset.
+//   NumericConst: c = bit pattern of the constant.
+//   Simd:         a = alignment, b = lane index, c = offset.
+//   SimdConst:    a = index into AotModule::v128s.
+//   SimdShuffle:  a = index into AotModule::v128s holding the lane indices.
+//   BulkMemory:   a = segment index, b = destination, c = source.
+//   Atomic:       a = alignment, c = offset.
+// Block positions are indices into AotModule::instructions.
+struct AotInstruction {
+  InstructionType type;
+  // Opcode of the instruction within its type, e.g. a NumericInstruction::Type.
+  uint32_t opcode;
+  uint32_t a;
+  uint32_t b;
+  uint64_t c;
+};
+
+struct AotLocal {
+  uint32_t n;
+  ValueType t;
+};
+
+struct AotFunction {
+  // Range in AotModule::locals.
+  uint32_t local_offset;
+  uint32_t local_count;
+  // Range in AotModule::instructions.
+  uint32_t code_offset;
+  uint32_t code_count;
+  // See Func::Frame.
+  uint32_t max_stack_height;
+  uint64_t locals_size;
+};
+
+struct AotModule {
+  const ValueType* value_types;
+  const char* names;
+  const AotFuncType* types;
+  uint32_t type_count;
+  const AotImport* imports;
+  uint32_t import_count;
+  const AotExport* exports;
+  uint32_t export_count;
+  // Type index per function in the function index space, imported functions
+  // first.
+  const uint32_t* func_types;
+  uint32_t func_count;
+  uint32_t imported_func_count;
+  // Bodies of the defined functions.
+  const AotFunction* functions;
+  const AotLocal* locals;
+  const AotInstruction* instructions;
+  uint32_t instruction_count;
+  const uint32_t* labels;
+  // 16-byte immediates of SIMD instructions.
+  const V128* v128s;
+};
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_AOT_MODULE_H
@@ -26,9 +26,10 @@
 #ifndef WASMPARSER_CPP_BUFFER_H
 #define WASMPARSER_CPP_BUFFER_H
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-#include <fstream>
 #include <memory>
 #include <string_view>
 #include <vector>
@@ -42,6 +43,11 @@ class ZeroCopyBuffer {
       std::string_view filename);
   ZeroCopyBuffer(const ZeroCopyBuffer& buf) = delete;
   ZeroCopyBuffer(char* buf, size_t size);
+  explicit ZeroCopyBuffer(std::vector<Byte> buf) : buf_(std::move(buf)) {}
+
+  // Replaces the contents with the file `filename`, reusing the storage of
+  // the previous contents.
+  void load(std::string_view filename);
 
   Byte* at(size_t idx);
   size_t size() const { return buf_.size(); }
@@ -52,15 +58,35 @@ class ZeroCopyBuffer {
 
 std::unique_ptr<ZeroCopyBuffer> ZeroCopyBuffer::createBuffer(
     std::string_view filename) {
+  auto buf = std::make_unique<ZeroCopyBuffer>(std::vector<Byte>{});
+  buf->load(filename);
+  return buf;
+}
+
+void ZeroCopyBuffer::load(std::string_view filename) {
   struct stat result;
   if (stat(filename.data(), &result) != 0) {
     throw std::runtime_error("Failed to check file stats.");
   }
   auto size = result.st_size;
-  std::ifstream stream(filename.data(), std::ios::in | std::ios::binary);
-  char buf[size];
-  stream.read(buf, size);
-  return std::make_unique<ZeroCopyBuffer>(&buf[0], size);
+  // Read with POSIX I/O, which unlike a stream doesn't allocate a buffer of
+  // its own on every load.
+  int fd = ::open(filename.data(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open file.");
+  }
+  // Read into the heap, as modules may be larger than the stack.
+  buf_.resize(size);
+  size_t n = 0;
+  while (n < buf_.size()) {
+    ssize_t res = ::read(fd, buf_.data() + n, buf_.size() - n);
+    if (res <= 0) {
+      break;
+    }
+    n += res;
+  }
+  ::close(fd);
+  buf_.resize(n);
 }
 
 Byte* ZeroCopyBuffer::at(size_t idx) {
@@ -70,13 +96,11 @@ Byte* ZeroCopyBuffer::at(size_t idx) {
   return &buf_[idx];
 }
 
-ZeroCopyBuffer::ZeroCopyBuffer(char* buf, size_t size) {
-  for (auto i = 0; i < size; ++i) {
-    buf_.emplace_back(static_cast<Byte>(buf[i]));
-  }
-}
+ZeroCopyBuffer::ZeroCopyBuffer(char* buf, size_t size)
+    : buf_(reinterpret_cast<Byte*>(buf), reinterpret_cast<Byte*>(buf) + size) {}
 
-using ZeroCopyBufferPtr = std::unique_ptr<ZeroCopyBuffer>;
+// Shared, so that the sections of a buffer can be parsed concurrently.
+using ZeroCopyBufferPtr = std::shared_ptr<ZeroCopyBuffer>;
 
 }  // namespace wasmparser
 
@@ -0,0 +1,262 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_CALL_GRAPH_H
+#define WASMPARSER_CPP_CALL_GRAPH_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "instruction_decoder.h"
+#include "module.h"
+
+namespace wasmparser {
+
+// Direct calls between functions of a decoded module. Functions are numbered
+// in the function index space, imports first. Exported functions, the start
+// function and functions referenced by element segments are roots: they can
+// be called from outside or through call_indirect.
+class CallGraph {
+ public:
+  CallGraph(const Module* m, const InstructionDecoder* d);
+
+  uint32_t funcCount() const { return static_cast<uint32_t>(callees_.size()); }
+  uint32_t importedFuncCount() const { return imported_func_count_; }
+  // Sorted and deduplicated direct callees. Empty for imported functions.
+  const std::vector<uint32_t>& callees(uint32_t func_idx) const {
+    return callees_[func_idx];
+  }
+  const std::vector<uint32_t>& roots() const { return roots_; }
+
+  // Whether each function is reachable from the roots.
+  std::vector<bool> reachableFuncs() const;
+  // Defined functions unreachable from the roots, in increasing order.
+  // Imported functions are never reported, as removing them would change the
+  // module's interface.
+  std::vector<uint32_t> deadFuncs() const;
+
+ private:
+  static void collectCalls(const std::vector<Instruction>& instrs,
+                           std::vector<uint32_t>* callees);
+
+  uint32_t imported_func_count_{0};
+  std::vector<std::vector<uint32_t>> callees_;
+  std::vector<uint32_t> roots_;
+};
+
+// Removes the dead functions of the call graph from `m` and `d`, renumbers
+// the remaining functions and rewrites calls, exports, the start function
+// and element segments accordingly. Returns the removed function indices as
+// numbered before stripping.
+//
+// Afterwards the decoded sections of `d` are authoritative: the raw code and
+// element sections of `m` are cleared, since their bytes no longer match,
+// and the "name" custom section is dropped, since it names functions by
+// index. Code offsets and incremental decoding state of `d` are cleared too.
+std::vector<uint32_t> stripDeadFunctions(Module* m, InstructionDecoder* d);
+
+CallGraph::CallGraph(const Module* m, const InstructionDecoder* d)
+    : imported_func_count_(d->imported_func_count_),
+      callees_(d->imported_func_count_ + d->cs_.size()) {
+  for (size_t i = 0; i < d->cs_.size(); ++i) {
+    auto& callees = callees_[imported_func_count_ + i];
+    collectCalls(d->cs_[i].code->expr, &callees);
+    std::sort(callees.begin(), callees.end());
+    callees.erase(std::unique(callees.begin(), callees.end()), callees.end());
+  }
+  for (const auto& e : m->export_sec.value) {
+    if (e.desc.type == Export::ExportDesc::ExportDescType::FuncIdx) {
+      roots_.emplace_back(e.desc.idx);
+    }
+  }
+  if (m->start_sec.size != 0) {
+    roots_.emplace_back(m->start_sec.value);
+  }
+  for (const auto& eseg : d->es_) {
+    roots_.insert(roots_.end(), eseg.init.begin(), eseg.init.end());
+  }
+  std::sort(roots_.begin(), roots_.end());
+  roots_.erase(std::unique(roots_.begin(), roots_.end()), roots_.end());
+}
+
+void CallGraph::collectCalls(const std::vector<Instruction>& instrs,
+                             std::vector<uint32_t>* callees) {
+  for (const auto& i : instrs) {
+    if (i.type == InstructionType::Call &&
+        i.call_instruction.type == CallInstruction::Type::CALL) {
+      callees->emplace_back(i.call_instruction.index);
+    } else if (i.type == InstructionType::Block) {
+      collectCalls(i.block_instruction.instructions, callees);
+      collectCalls(i.block_instruction.else_instructions, callees);
+    }
+  }
+}
+
+std::vector<bool> CallGraph::reachableFuncs() const {
+  std::vector<bool> reachable(funcCount(), false);
+  std::vector<uint32_t> worklist;
+  for (auto idx : roots_) {
+    // Out of range indices belong to malformed modules and are ignored.
+    if (idx < funcCount() && !reachable[idx]) {
+      reachable[idx] = true;
+      worklist.emplace_back(idx);
+    }
+  }
+  while (!worklist.empty()) {
+    auto idx = worklist.back();
+    worklist.pop_back();
+    for (auto callee : callees_[idx]) {
+      if (callee < funcCount() && !reachable[callee]) {
+        reachable[callee] = true;
+        worklist.emplace_back(callee);
+      }
+    }
+  }
+  return reachable;
+}
+
+std::vector<uint32_t> CallGraph::deadFuncs() const {
+  auto reachable = reachableFuncs();
+  std::vector<uint32_t> dead;
+  for (uint32_t idx = imported_func_count_; idx < funcCount(); ++idx) {
+    if (!reachable[idx]) {
+      dead.emplace_back(idx);
+    }
+  }
+  return dead;
+}
+
+namespace {
+
+constexpr uint32_t REMOVED_FUNC = std::numeric_limits<uint32_t>::max();
+
+void remapCalls(std::vector<Instruction>* instrs,
+                const std::vector<uint32_t>& new_idx) {
+  for (auto& i : *instrs) {
+    if (i.type == InstructionType::Call &&
+        i.call_instruction.type == CallInstruction::Type::CALL &&
+        i.call_instruction.index < new_idx.size()) {
+      i.call_instruction.index = new_idx[i.call_instruction.index];
+    } else if (i.type == InstructionType::Block) {
+      remapCalls(&i.block_instruction.instructions, new_idx);
+      remapCalls(&i.block_instruction.else_instructions, new_idx);
+    }
+  }
+}
+
+}  // namespace
+
+std::vector<uint32_t> stripDeadFunctions(Module* m, InstructionDecoder* d) {
+  CallGraph graph(m, d);
+  auto dead = graph.deadFuncs();
+  if (dead.empty()) {
+    return dead;
+  }
+
+  std::vector<uint32_t> new_idx(graph.funcCount());
+  uint32_t next = 0;
+  for (uint32_t idx = 0, di = 0; idx < graph.funcCount(); ++idx) {
+    if (di < dead.size() && dead[di] == idx) {
+      new_idx[idx] = REMOVED_FUNC;
+      ++di;
+    } else {
+      new_idx[idx] = next++;
+    }
+  }
+  auto remap = [&new_idx](uint32_t idx) {
+    return idx < new_idx.size() ? new_idx[idx] : idx;
+  };
+
+  std::vector<uint32_t> func_sec;
+  CodeSection code;
+  for (size_t i = 0; i < d->cs_.size(); ++i) {
+    uint32_t idx = graph.importedFuncCount() + i;
+    if (new_idx[idx] == REMOVED_FUNC) {
+      continue;
+    }
+    func_sec.emplace_back(m->func_sec.value[i]);
+    auto& c = d->cs_[i];
+    // Bodies are shared and immutable, so only those calling a renumbered
+    // function are copied.
+    const auto& callees = graph.callees(idx);
+    bool renumbered =
+        !callees.empty() && callees.back() > dead.front();
+    if (renumbered) {
+      Func f = *c.code;
+      remapCalls(&f.expr, new_idx);
+      c.code = std::make_shared<const Func>(std::move(f));
+    }
+    code.emplace_back(std::move(c));
+  }
+  m->func_sec.value = std::move(func_sec);
+  m->func_space.resetDefined();
+  m->func_space.entries.insert(m->func_space.entries.end(),
+                               m->func_sec.value.begin(),
+                               m->func_sec.value.end());
+  d->cs_ = std::move(code);
+
+  for (auto& e : m->export_sec.value) {
+    if (e.desc.type == Export::ExportDesc::ExportDescType::FuncIdx) {
+      e.desc.idx = remap(e.desc.idx);
+    }
+  }
+  if (m->start_sec.size != 0) {
+    m->start_sec.value = remap(m->start_sec.value);
+  }
+  for (auto& eseg : d->es_) {
+    for (auto& idx : eseg.init) {
+      idx = remap(idx);
+    }
+  }
+
+  // The "name" section is dropped together with its place in the section
+  // order.
+  const Name name_section{'n', 'a', 'm', 'e'};
+  std::vector<CustomSection> customs;
+  std::vector<SectionId> order;
+  size_t custom_idx = 0;
+  for (auto id : m->section_order) {
+    if (id == SectionId::Custom && custom_idx < m->custom_sec.size() &&
+        m->custom_sec[custom_idx++].value.name == name_section) {
+      continue;
+    }
+    order.emplace_back(id);
+  }
+  for (auto& cs : m->custom_sec) {
+    if (cs.value.name != name_section) {
+      customs.emplace_back(std::move(cs));
+    }
+  }
+  m->custom_sec = std::move(customs);
+  m->section_order = std::move(order);
+  d->detachCode(m);
+  m->element_sec = RawBufferElementSection{};
+  return dead;
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_CALL_GRAPH_H
@@ -0,0 +1,160 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_CODE_OFFSET_INDEX_H
+#define WASMPARSER_CPP_CODE_OFFSET_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "memory_usage.h"
+
+namespace wasmparser {
+
+// Maps module byte offsets inside the code section to functions and
+// instructions, and back. Instruction indices count the instructions of a
+// function body in decoding order, so instructions nested in blocks are
+// numbered right after the block instruction that owns them.
+class CodeOffsetIndex {
+ public:
+  struct Location {
+    uint32_t func_idx;
+    uint32_t instr_idx;
+  };
+
+  // Function indices are reported in the function index space, so the first
+  // decoded body is numbered after the imported functions.
+  void reset(uint32_t imported_func_count);
+  void beginFunc(size_t offset);
+  void addInstruction(size_t offset);
+  void endFunc(size_t offset);
+  // Records a body identical to function `func_idx` of `other`, which now
+  // starts at `offset`. Relative instruction offsets carry over unchanged.
+  bool copyFunc(const CodeOffsetIndex& other, uint32_t func_idx, size_t offset);
+
+  std::optional<Location> lookup(size_t offset) const;
+  std::optional<size_t> offsetOf(Location loc) const;
+  size_t funcCount() const { return func_starts_.size(); }
+  MemoryUsage memoryUsage() const;
+
+ private:
+  uint32_t imported_func_count_{0};
+  // Module offsets of each function body, sorted because bodies are laid out
+  // in order. Instruction offsets are relative to the body start to keep the
+  // per-function tables small.
+  std::vector<size_t> func_starts_;
+  std::vector<size_t> func_ends_;
+  std::vector<std::vector<uint32_t>> instr_offsets_;
+};
+
+void CodeOffsetIndex::reset(uint32_t imported_func_count) {
+  imported_func_count_ = imported_func_count;
+  func_starts_.clear();
+  func_ends_.clear();
+  instr_offsets_.clear();
+}
+
+void CodeOffsetIndex::beginFunc(size_t offset) {
+  func_starts_.emplace_back(offset);
+  func_ends_.emplace_back(offset);
+  instr_offsets_.emplace_back();
+}
+
+void CodeOffsetIndex::addInstruction(size_t offset) {
+  instr_offsets_.back().emplace_back(
+      static_cast<uint32_t>(offset - func_starts_.back()));
+}
+
+void CodeOffsetIndex::endFunc(size_t offset) {
+  func_ends_.back() = offset;
+  instr_offsets_.back().shrink_to_fit();
+}
+
+bool CodeOffsetIndex::copyFunc(const CodeOffsetIndex& other, uint32_t func_idx,
+                               size_t offset) {
+  if (func_idx < other.imported_func_count_) {
+    return false;
+  }
+  size_t code_idx = func_idx - other.imported_func_count_;
+  if (code_idx >= other.func_starts_.size()) {
+    return false;
+  }
+  func_starts_.emplace_back(offset);
+  func_ends_.emplace_back(offset + other.func_ends_[code_idx] -
+                          other.func_starts_[code_idx]);
+  instr_offsets_.emplace_back(other.instr_offsets_[code_idx]);
+  return true;
+}
+
+std::optional<CodeOffsetIndex::Location> CodeOffsetIndex::lookup(
+    size_t offset) const {
+  auto fit = std::upper_bound(func_starts_.begin(), func_starts_.end(), offset);
+  if (fit == func_starts_.begin()) {
+    return std::nullopt;
+  }
+  size_t code_idx = std::distance(func_starts_.begin(), fit) - 1;
+  if (offset >= func_ends_[code_idx]) {
+    return std::nullopt;
+  }
+  const auto& instrs = instr_offsets_[code_idx];
+  auto rel = static_cast<uint32_t>(offset - func_starts_[code_idx]);
+  auto iit = std::upper_bound(instrs.begin(), instrs.end(), rel);
+  if (iit == instrs.begin()) {
+    // The offset points into the local declarations.
+    return std::nullopt;
+  }
+  Location loc;
+  loc.func_idx = imported_func_count_ + static_cast<uint32_t>(code_idx);
+  loc.instr_idx = static_cast<uint32_t>(std::distance(instrs.begin(), iit) - 1);
+  return loc;
+}
+
+std::optional<size_t> CodeOffsetIndex::offsetOf(Location loc) const {
+  if (loc.func_idx < imported_func_count_) {
+    return std::nullopt;
+  }
+  size_t code_idx = loc.func_idx - imported_func_count_;
+  if (code_idx >= instr_offsets_.size() ||
+      loc.instr_idx >= instr_offsets_[code_idx].size()) {
+    return std::nullopt;
+  }
+  return func_starts_[code_idx] + instr_offsets_[code_idx][loc.instr_idx];
+}
+
+MemoryUsage CodeOffsetIndex::memoryUsage() const {
+  MemoryUsage u = vectorMemoryUsage(func_starts_);
+  u += vectorMemoryUsage(func_ends_);
+  u += vectorMemoryUsage(instr_offsets_);
+  for (const auto& offsets : instr_offsets_) {
+    u += vectorMemoryUsage(offsets);
+  }
+  return u;
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_CODE_OFFSET_INDEX_H
@@ -0,0 +1,293 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_COMPRESSED_INPUT_H
+#define WASMPARSER_CPP_COMPRESSED_INPUT_H
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "module.h"
+#include "parser.h"
+
+// Needs zlib. The wasmparser-cpp target links it and defines
+// WASMPARSER_CPP_HAVE_ZLIB when CMake finds it.
+
+namespace wasmparser {
+
+struct CompressedInputOptions {
+  // Inflate custom sections without keeping them, e.g. to drop debug info.
+  bool skip_custom_sections = false;
+  // Bytes read from the compressed file at a time.
+  size_t chunk_size = 64 * 1024;
+  // Inflated sections which may wait for the parser.
+  size_t max_queued_sections = 2;
+};
+
+// Inflates a gzip or zlib file a part at a time.
+class InflateReader {
+ public:
+  InflateReader(std::string_view filename, size_t chunk_size);
+  ~InflateReader() { inflateEnd(&zs_); }
+  InflateReader(const InflateReader&) = delete;
+  InflateReader& operator=(const InflateReader&) = delete;
+
+  // Inflates up to `n` bytes into `out` and returns their number, which is
+  // less than `n` only at the end of the stream.
+  size_t read(Byte* out, size_t n);
+  // Inflates `n` bytes and drops them. Returns false at the end of the
+  // stream.
+  bool skip(size_t n);
+  // Inflated bytes read so far.
+  size_t offset() const { return offset_; }
+
+ private:
+  std::ifstream file_;
+  z_stream zs_{};
+  std::vector<Byte> in_;
+  bool end_{false};
+  size_t offset_{0};
+};
+
+// Parses a gzip or zlib compressed module. A thread inflates the file one
+// section at a time while the calling thread parses the sections inflated
+// before, so the module is never held inflated as a whole. Errors are
+// thrown as by Parser::doParse.
+Module parseCompressedModule(std::string_view filename,
+                             const CompressedInputOptions& options = {});
+
+InflateReader::InflateReader(std::string_view filename, size_t chunk_size)
+    : file_(std::string(filename), std::ios::in | std::ios::binary),
+      in_(chunk_size) {
+  if (!file_) {
+    throw std::runtime_error("Failed to open compressed module.");
+  }
+  // 32 added to the window bits detects gzip and zlib headers.
+  if (inflateInit2(&zs_, MAX_WBITS + 32) != Z_OK) {
+    throw std::runtime_error("Failed to initialize zlib.");
+  }
+}
+
+size_t InflateReader::read(Byte* out, size_t n) {
+  size_t done = 0;
+  while (done < n && !end_) {
+    if (zs_.avail_in == 0) {
+      file_.read(reinterpret_cast<char*>(in_.data()), in_.size());
+      zs_.next_in = in_.data();
+      zs_.avail_in = static_cast<uInt>(file_.gcount());
+      if (zs_.avail_in == 0) {
+        throw std::runtime_error("Truncated compressed module");
+      }
+    }
+    // avail_out is 32 bits wide, so large reads are split.
+    size_t step = std::min<size_t>(n - done, 1u << 30);
+    zs_.next_out = out + done;
+    zs_.avail_out = static_cast<uInt>(step);
+    int ret = inflate(&zs_, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      end_ = true;
+    } else if (ret != Z_OK) {
+      throw std::runtime_error("Failed to inflate module");
+    }
+    done += step - zs_.avail_out;
+  }
+  offset_ += done;
+  return done;
+}
+
+bool InflateReader::skip(size_t n) {
+  Byte scratch[4096];
+  while (n > 0) {
+    size_t step = std::min(n, sizeof(scratch));
+    if (read(scratch, step) != step) {
+      return false;
+    }
+    n -= step;
+  }
+  return true;
+}
+
+namespace {
+
+// Reads the next section with its id and size. Returns nullopt at the end
+// of the module.
+std::optional<Bytes> inflateSection(InflateReader* reader,
+                                    const CompressedInputOptions& options) {
+  while (true) {
+    Bytes section(1);
+    if (reader->read(section.data(), 1) == 0) {
+      return std::nullopt;
+    }
+    // Section sizes are u32, so their LEB128 takes at most five bytes.
+    uint32_t size = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+      Byte b;
+      if (shift > 28 || reader->read(&b, 1) != 1) {
+        throw std::runtime_error("Failed to parse sections");
+      }
+      section.emplace_back(b);
+      size |= static_cast<uint32_t>(b & 0x7F) << shift;
+      if ((b & 0x80) == 0) {
+        break;
+      }
+    }
+    auto id = static_cast<SectionId>(section[0]);
+    bool known = section[0] <= static_cast<Byte>(SectionId::DataCount);
+    if (!known || (id == SectionId::Custom && options.skip_custom_sections)) {
+      // Dropped by the parser anyway, so they are not kept inflated.
+      if (!reader->skip(size)) {
+        throw std::runtime_error("Failed to parse sections");
+      }
+      continue;
+    }
+    // The buffer grows as the payload is inflated rather than by the
+    // declared size up front, which a file of a few bytes could make 4 GiB.
+    size_t header = section.size();
+    for (size_t done = 0; done < size;) {
+      size_t step = std::min<size_t>(size - done, options.chunk_size);
+      section.resize(header + done + step);
+      if (reader->read(section.data() + header + done, step) != step) {
+        throw std::runtime_error("Failed to parse sections");
+      }
+      done += step;
+    }
+    return section;
+  }
+}
+
+}  // namespace
+
+Module parseCompressedModule(std::string_view filename,
+                             const CompressedInputOptions& options) {
+  InflateReader reader(filename, options.chunk_size);
+  std::array<Byte, 8> header;
+  if (reader.read(header.data(), header.size()) != header.size() ||
+      std::memcmp(header.data(), MAGIC.data(), MAGIC.size()) != 0) {
+    throw std::runtime_error("Invalid magic number");
+  }
+  if (std::memcmp(header.data() + MAGIC.size(), VERSION.data(),
+                  VERSION.size()) != 0) {
+    throw std::runtime_error("Invalid version number");
+  }
+
+  // Sections with their module offsets, from the inflating thread to the
+  // parsing one.
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<std::pair<size_t, Bytes>> queue;
+  bool inflated = false;
+  bool stop = false;
+  std::exception_ptr error;
+
+  std::thread inflater([&] {
+    try {
+      while (true) {
+        size_t offset = reader.offset();
+        auto section = inflateSection(&reader, options);
+        if (!section.has_value()) {
+          break;
+        }
+        std::unique_lock<std::mutex> lock(mu);
+        cv.wait(lock, [&] {
+          return stop || queue.size() < options.max_queued_sections;
+        });
+        if (stop) {
+          break;
+        }
+        queue.emplace_back(offset, std::move(*section));
+        cv.notify_all();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mu);
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mu);
+    inflated = true;
+    cv.notify_all();
+  });
+
+  Module m;
+  bool parsed = true;
+  std::exception_ptr parse_error;
+  while (true) {
+    std::pair<size_t, Bytes> next;
+    {
+      std::unique_lock<std::mutex> lock(mu);
+      cv.wait(lock, [&] { return !queue.empty() || inflated; });
+      if (queue.empty()) {
+        break;
+      }
+      next = std::move(queue.front());
+      queue.pop_front();
+      cv.notify_all();
+    }
+    auto buf = std::make_unique<ZeroCopyBuffer>(std::move(next.second));
+    // A malformed section can also throw, e.g. on a read past its end. The
+    // inflater is stopped and joined first either way, as destroying a
+    // joinable thread terminates the process.
+    try {
+      parsed = Parser::doParseSections(std::move(buf), next.first, &m);
+    } catch (...) {
+      parse_error = std::current_exception();
+      parsed = false;
+    }
+    if (!parsed) {
+      std::lock_guard<std::mutex> lock(mu);
+      stop = true;
+      cv.notify_all();
+      break;
+    }
+  }
+  inflater.join();
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+  if (parse_error != nullptr) {
+    std::rethrow_exception(parse_error);
+  }
+  if (!parsed) {
+    throw std::runtime_error("Failed to parse sections");
+  }
+  m.buildIndexSpaces();
+  return m;
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_COMPRESSED_INPUT_H
@@ -0,0 +1,135 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_FUNC_STORE_H
+#define WASMPARSER_CPP_FUNC_STORE_H
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "module.h"
+
+namespace wasmparser {
+
+// Content-addressed store of decoded function bodies. Modules which contain
+// byte-identical bodies share a single immutable Func through it. The store
+// only holds weak references, so a Func is released together with the last
+// module using it.
+class FuncStore {
+ public:
+  // Process-wide store.
+  static FuncStore& global();
+
+  // Returns the Func decoded from `body` if it is still alive.
+  std::shared_ptr<const Func> find(uint64_t hash, const Byte* body,
+                                   size_t size);
+  // Registers `f` as the decoded form of `body`. If an identical body has
+  // been interned meanwhile, that Func is returned instead.
+  std::shared_ptr<const Func> intern(uint64_t hash, const Byte* body,
+                                     size_t size, Func&& f);
+  // Drops entries whose Func has been released.
+  void purge();
+  size_t size();
+
+ private:
+  struct Entry {
+    Bytes body;
+    std::weak_ptr<const Func> func;
+  };
+
+  std::shared_ptr<const Func> findLocked(uint64_t hash, const Byte* body,
+                                         size_t size);
+
+  std::mutex mutex_;
+  std::unordered_multimap<uint64_t, Entry> entries_;
+};
+
+FuncStore& FuncStore::global() {
+  static FuncStore store;
+  return store;
+}
+
+std::shared_ptr<const Func> FuncStore::findLocked(uint64_t hash,
+                                                  const Byte* body,
+                                                  size_t size) {
+  auto range = entries_.equal_range(hash);
+  for (auto it = range.first; it != range.second;) {
+    auto f = it->second.func.lock();
+    if (f == nullptr) {
+      it = entries_.erase(it);
+      continue;
+    }
+    // Bodies are compared as well, so a hash collision never hands out a
+    // function of another module.
+    if (it->second.body.size() == size &&
+        std::equal(body, body + size, it->second.body.begin())) {
+      return f;
+    }
+    ++it;
+  }
+  return nullptr;
+}
+
+std::shared_ptr<const Func> FuncStore::find(uint64_t hash, const Byte* body,
+                                            size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return findLocked(hash, body, size);
+}
+
+std::shared_ptr<const Func> FuncStore::intern(uint64_t hash, const Byte* body,
+                                              size_t size, Func&& f) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (auto existing = findLocked(hash, body, size)) {
+    return existing;
+  }
+  auto shared = std::make_shared<const Func>(std::move(f));
+  Entry e;
+  e.body.assign(body, body + size);
+  e.func = shared;
+  entries_.emplace(hash, std::move(e));
+  return shared;
+}
+
+void FuncStore::purge() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->second.func.expired()) {
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+size_t FuncStore::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_FUNC_STORE_H
@@ -0,0 +1,70 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_HASH_H
+#define WASMPARSER_CPP_HASH_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "value.h"
+
+namespace wasmparser {
+
+constexpr uint64_t HASH_SEED = 0x9E3779B97F4A7C15ull;
+
+uint64_t mixHash(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+uint64_t combineHash(uint64_t seed, uint64_t v) {
+  return mixHash(seed ^ (v + HASH_SEED + (seed << 6) + (seed >> 2)));
+}
+
+// Content hash of a byte range. It consumes eight bytes per step, which keeps
+// hashing whole function bodies far cheaper than decoding them.
+uint64_t hashBytes(const Byte* buf, size_t size, uint64_t seed = HASH_SEED) {
+  uint64_t h = seed ^ (size * 0x87C37B91114253D5ull);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w;
+    std::memcpy(&w, buf + i, sizeof(w));
+    h = (h ^ mixHash(w)) * 0x4CF5AD432745937Full;
+  }
+  uint64_t tail = 0;
+  for (size_t shift = 0; i < size; ++i, shift += 8) {
+    tail |= static_cast<uint64_t>(buf[i]) << shift;
+  }
+  return mixHash(h ^ mixHash(tail));
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_HASH_H
@@ -27,29 +27,101 @@
 #ifndef WASMPARSER_CPP_INSTRUCTION_DECODER_H
 #define WASMPARSER_CPP_INSTRUCTION_DECODER_H
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "code_offset_index.h"
+#include "func_store.h"
+#include "hash.h"
 #include "instructions.h"
 #include "leb128.h"
 #include "module.h"
+#include "stack_effect.h"
+#include "thread_pool.h"
 
 namespace wasmparser {
 
+class InstructionDecoder;
+
+// Cap on DecoderOptions::max_block_depth. Decoding and StackEffects walk
+// nested blocks with explicit stacks, but the transformation passes, the
+// writer and the destruction of a Func recurse into them, and stay well
+// within the default 8 MiB thread stack at this depth.
+constexpr uint32_t MAX_BLOCK_DEPTH = 4096;
+
+struct DecoderOptions {
+  // Record the byte offsets of function bodies and their instructions into
+  // InstructionDecoder::code_offsets_.
+  bool record_code_offsets = false;
+  // Hash every function body so that the decoder can serve as `previous`
+  // when the next version of the module is decoded. The decoder takes the
+  // raw code section over from the module, as transformations do, to
+  // compare the next version's bodies against it without a copy.
+  bool incremental = false;
+  // Decoded previous version of the module. Bodies which are byte-identical
+  // to one of its bodies are copied from it instead of being decoded. Only
+  // used during construction.
+  const InstructionDecoder* previous = nullptr;
+  // Intern decoded bodies through this store, e.g. FuncStore::global(), so
+  // that identical bodies of different modules share one Func.
+  FuncStore* store = nullptr;
+  // Deepest block nesting accepted in an expression. Values above
+  // MAX_BLOCK_DEPTH are clamped to it.
+  uint32_t max_block_depth = 1024;
+  // Decode function bodies concurrently on this pool, e.g.
+  // &ThreadPool::global(). Bodies are decoded serially while code offsets
+  // are recorded, as those are recorded in module order.
+  ThreadPool* pool = nullptr;
+};
+
 class InstructionDecoder {
  public:
-  InstructionDecoder(Module* m);
+  // Constructs a reusable decoder, which decodes modules through decode().
+  InstructionDecoder() : recycle_funcs_(true) {}
+  InstructionDecoder(Module* m, DecoderOptions options = {});
+
+  // Decodes `m` like the constructor, after reset(). `m` must not be moved
+  // while the decoder is in use, and `options.previous` must be another
+  // decoder.
+  void decode(Module* m, DecoderOptions options = {});
+  // Drops the decoded sections and bookkeeping, keeping their storage.
+  // Decoders made by the default constructor also keep the bodies they
+  // decoded which no one else holds, and decode the next bodies into them.
+  void reset();
 
   bool decodeGlobalSection(RawBufferGlobalSection* gs);
   bool decodeElementSection(RawBufferElementSection* es);
   bool decodeDataSection(RawBufferDataSection* ds);
   bool decodeCodeSection(RawBufferCodeSection* cs);
 
+  // Heap bytes owned by the decoded sections and bookkeeping.
+  DecoderMemoryUsage memoryUsage() const;
+
   int32_t decodeValueType(ValueType* vt);
   int32_t decodeU32Integer(uint32_t* idx);
+  int32_t decodeU64Integer(uint64_t* idx);
   int32_t decodeI32Integer(int32_t* idx);
   int32_t decodeI64Integer(int64_t* idx);
   int32_t decodeS33AsI64(int64_t* idx);
+  // Little endian value stored in its full width, e.g. a float constant.
+  template <class T>
+  int32_t decodeFixedWidth(T* v) {
+    if (idx_ + sizeof(T) > target_section_->value.size()) {
+      return -1;
+    }
+    std::memcpy(v, fetchByte(), sizeof(T));
+    idx_ += sizeof(T);
+    return sizeof(T);
+  }
   int32_t decodeGlobalType(GlobalType* gt);
+  // Decodes instructions up to the matching end, including the bodies of
+  // nested blocks, without recursion.
   int32_t decodeExpr(std::vector<Instruction>* iseq);
-  int32_t decodeFunc(Func* f);
+  // Decodes the body of a function of type `type` and computes its frame.
+  int32_t decodeFunc(Func* f, const FuncType& type);
   int32_t decodeLocals(Func::Local* l);
 
   // Instruction decoder
@@ -62,15 +134,80 @@ class InstructionDecoder {
   int32_t decodeVariableInstruction(VariableInstruction* vi);
   int32_t decodeParametricInstruction(ParametricInstruction* pi);
   int32_t decodeBlockType(BlockInstruction* bi);
+  // Decodes the opcode and the block type. The body is left to decodeExpr.
   int32_t decodeBlockInstruction(BlockInstruction* bi);
   int32_t decodeBranchInstruction(BranchInstruction* bi);
   int32_t decodeTableBranchInstruction(TableBranchInstruction* tbi);
   int32_t decodeCallInstruction(CallInstruction* ci);
+  // Decodes into one of the Simd, SimdConst and SimdShuffle instructions.
+  int32_t decodeSimdInstruction(Instruction* i);
+  // Decodes 0xFC-prefixed instructions.
+  int32_t decodeMiscInstruction(Instruction* i);
+  int32_t decodeAtomicInstruction(AtomicInstruction* ai);
 
+  // A code entry of the section decoded in parallel.
+  struct CodeEntry {
+    size_t start;
+    size_t body_start;
+    Code code;
+    uint64_t hash;
+    bool reused;
+  };
+  // Decodes the bodies on options_.pool, after delimiting them serially.
+  bool decodeCodeSectionParallel(RawBufferCodeSection* cs);
+  // Decodes entry `k` with `cursor`, a decoder of its own, so that entries
+  // are decoded concurrently. `f` is the Func to decode into, unless bodies
+  // are interned. Only reads the decoder, as offsets aren't recorded.
+  bool decodeCodeEntry(InstructionDecoder* cursor, uint32_t k,
+                       std::shared_ptr<Func> f, CodeEntry* e);
+  // Appends a decoded code entry, which spans the raw code section from
+  // `entry_start` and whose body starts at `body_start`.
+  void addCode(Code c, size_t entry_start, size_t body_start);
+  // Moves the raw code section out of `m` into detached_code_.
+  void takeCode(Module* m);
+  // Takes the raw code section, for transformations which make it stale,
+  // and drops the state which refers to it: the code offsets and the
+  // incremental decoding state. ModuleWriter still copies the entries they
+  // left unchanged from the section.
+  void detachCode(Module* m);
+  // Reuses the body of options_.previous which is byte-identical to `body`,
+  // `c->size` bytes long with hash `hash`.
+  bool reuseFunc(uint64_t hash, const Byte* body, Code* c);
+  // Empties `expr` of a recycled body, keeping its nested sequences in
+  // spare_seqs_.
+  void recycleExpr(std::vector<Instruction>* expr);
+  // Gives the empty `seq` of a block about to be decoded the storage of a
+  // spare sequence, if there is one.
+  void takeSpareSeq(std::vector<Instruction>* seq);
+  // An empty Func to decode a body into, recycled if possible.
+  std::shared_ptr<Func> newFunc();
+  // Bodies reused from another module may belong to a function of another
+  // type, so their frames are recomputed and the body is copied if the frame
+  // differs.
+  bool updateFrame(const FuncType& type, Code* c);
+
+  // Byte `offset` bytes past the cursor. Throws like ZeroCopyBuffer::at
+  // past the end of the section, e.g. on a truncated immediate.
   Byte* fetchByte(size_t offset = 0) {
+    if (idx_ + offset >= target_section_->value.size()) {
+      throw std::runtime_error("Invalid buffer access");
+    }
     return &target_section_->value[idx_ + offset];
   }
 
+  // Reserves room for the entries of the current section, or for `n`
+  // entries of a vector about to be decoded. Every entry takes at least a
+  // byte, so a corrupt count can't reserve more than the rest of the
+  // section.
+  template <class V>
+  void reserveEntries(V* v) {
+    reserveEntries(v, target_section_->count);
+  }
+  template <class V>
+  void reserveEntries(V* v, uint32_t n) {
+    v->reserve(std::min<size_t>(n, target_section_->value.size() - idx_));
+  }
+
   uint32_t fetchVecSize() {
     uint32_t size;
     if (decodeU32Integer(&size) < 0) {
@@ -79,19 +216,100 @@ class InstructionDecoder {
     return size;
   }
 
-  size_t idx_;
-  Section<Bytes>* target_section_;
+  size_t moduleOffset() const { return target_section_->offset + idx_; }
+
+  size_t idx_{0};
+  RawBufferSection* target_section_{nullptr};
+  DecoderOptions options_;
+  StackEffects effects_;
+  uint32_t imported_func_count_{0};
+  // Whether memory 0 is a memory64 memory, which allows u64 memarg offsets.
+  bool memory64_{false};
+  // Set while decoding function bodies, so that instructions of constant
+  // expressions in other sections are not recorded.
+  bool recording_instructions_{false};
 
   DataSection ds_;
   CodeSection cs_;
   GlobalSection gs_;
   ElementSection es_;
+  CodeOffsetIndex code_offsets_;
+
+  // Raw bytes of a code entry, its size included, and the body decoded from
+  // them. A weak reference, so that a body replaced by a transformation
+  // isn't kept alive, while its address isn't reused for another body.
+  struct CodeSource {
+    std::weak_ptr<const Func> func;
+    size_t start;
+    size_t end;
+  };
+  // Source of each code entry as decoded, in the code section of the module
+  // or, once a transformation detached it, in detached_code_.
+  std::vector<CodeSource> code_sources_;
+  RawBufferCodeSection detached_code_;
+
+  // Content hash per code entry, filled in incremental mode. Bodies are
+  // only reused by the next version if their bytes in detached_code_ match
+  // too, and not just their hash.
+  std::vector<uint64_t> body_hashes_;
+  // Function indices whose bodies were decoded because the previous version
+  // had no identical body. Filled in incremental mode.
+  std::vector<uint32_t> changed_funcs_;
+  // Blocks open in decodeExpr, innermost last, with the sequence their
+  // instructions are decoded into. Kept to reuse its storage.
+  struct OpenBlock {
+    BlockInstruction* block;
+    std::vector<Instruction>* iseq;
+  };
+  std::vector<OpenBlock> open_blocks_;
+  // Body hash to code entry index of options_.previous.
+  std::unordered_map<uint64_t, uint32_t> previous_bodies_;
+
+  // Whether reset() recycles the decoded bodies.
+  bool recycle_funcs_{false};
+  // Bodies decoded since the last reset(), if they are recycled.
+  std::vector<std::shared_ptr<Func>> decoded_funcs_;
+  // Recycled bodies, taken by newFunc().
+  std::vector<std::shared_ptr<Func>> spare_funcs_;
+  // Emptied nested instruction sequences of recycled bodies, which the
+  // blocks of the next bodies are decoded into.
+  std::vector<std::vector<Instruction>> spare_seqs_;
+  // Entries of the module decoded before reset(), whose expressions and
+  // bytes the entries of the next module take over.
+  DataSection spare_ds_;
+  GlobalSection spare_gs_;
+  ElementSection spare_es_;
 };
 
-InstructionDecoder::InstructionDecoder(Module* m) {
+InstructionDecoder::InstructionDecoder(Module* m, DecoderOptions options) {
+  decode(m, options);
+}
+
+void InstructionDecoder::decode(Module* m, DecoderOptions options) {
+  reset();
+  options_ = options;
+  effects_ = StackEffects(m);
+  imported_func_count_ = m->func_space.imported;
+  // Memory arguments carry no memory index, so they all refer to memory 0.
+  memory64_ = !m->memory_space.entries.empty() &&
+              m->memory_space.entries[0].limit.is64;
+  if (options_.record_code_offsets) {
+    code_offsets_.reset(imported_func_count_);
+  }
+  if (options_.previous != nullptr) {
+    options_.incremental = true;
+    const auto& hashes = options_.previous->body_hashes_;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+      previous_bodies_.emplace(hashes[i], static_cast<uint32_t>(i));
+    }
+  }
   if (!decodeGlobalSection(&m->global_sec)) {
     throw std::runtime_error("Failed to decode global section.");
   }
+  m->global_space.resetDefined();
+  for (const auto& g : gs_) {
+    m->global_space.entries.emplace_back(g.type);
+  }
   if (!decodeDataSection(&m->data_sec)) {
     throw std::runtime_error("Failed to decode data section");
   }
@@ -101,20 +319,141 @@ InstructionDecoder::InstructionDecoder(Module* m) {
   if (!decodeElementSection(&m->element_sec)) {
     throw std::runtime_error("Failed to decode element section");
   }
+  if (options_.incremental) {
+    takeCode(m);
+  }
+  options_.previous = nullptr;
+  previous_bodies_.clear();
+}
+
+void InstructionDecoder::reset() {
+  idx_ = 0;
+  target_section_ = nullptr;
+  options_ = {};
+  effects_ = StackEffects();
+  imported_func_count_ = 0;
+  memory64_ = false;
+  recording_instructions_ = false;
+  keepSpares(&ds_, &spare_ds_);
+  cs_.clear();
+  keepSpares(&gs_, &spare_gs_);
+  keepSpares(&es_, &spare_es_);
+  code_offsets_.reset(0);
+  code_sources_.clear();
+  detached_code_.clear();
+  body_hashes_.clear();
+  changed_funcs_.clear();
+  open_blocks_.clear();
+  previous_bodies_.clear();
+  for (auto& f : decoded_funcs_) {
+    if (f.use_count() == 1) {
+      spare_funcs_.emplace_back(std::move(f));
+    }
+  }
+  decoded_funcs_.clear();
+}
+
+std::shared_ptr<Func> InstructionDecoder::newFunc() {
+  std::shared_ptr<Func> f;
+  if (spare_funcs_.empty()) {
+    f = std::make_shared<Func>();
+  } else {
+    f = std::move(spare_funcs_.back());
+    spare_funcs_.pop_back();
+    f->locals.clear();
+    recycleExpr(&f->expr);
+  }
+  if (recycle_funcs_) {
+    decoded_funcs_.emplace_back(f);
+  }
+  return f;
+}
+
+void InstructionDecoder::recycleExpr(std::vector<Instruction>* expr) {
+  // Nested sequences are moved out before the sequence holding them is
+  // cleared, which would free them.
+  auto harvest = [this](std::vector<Instruction>* seq) {
+    for (auto& i : *seq) {
+      if (i.type != InstructionType::Block) {
+        continue;
+      }
+      for (auto* nested : {&i.block_instruction.instructions,
+                           &i.block_instruction.else_instructions}) {
+        if (nested->capacity() != 0) {
+          spare_seqs_.emplace_back(std::move(*nested));
+        }
+      }
+    }
+    seq->clear();
+  };
+  size_t first = spare_seqs_.size();
+  harvest(expr);
+  for (size_t k = first; k < spare_seqs_.size(); ++k) {
+    // Harvesting appends to spare_seqs_, so the sequence is taken out while
+    // it is walked.
+    std::vector<Instruction> seq = std::move(spare_seqs_[k]);
+    harvest(&seq);
+    spare_seqs_[k] = std::move(seq);
+  }
+}
+
+void InstructionDecoder::takeSpareSeq(std::vector<Instruction>* seq) {
+  if (!spare_seqs_.empty()) {
+    *seq = std::move(spare_seqs_.back());
+    spare_seqs_.pop_back();
+  }
+}
+
+DecoderMemoryUsage InstructionDecoder::memoryUsage() const {
+  DecoderMemoryUsage u;
+  u.globals = vectorMemoryUsage(gs_);
+  for (const auto& g : gs_) {
+    u.globals += instructionsMemoryUsage(g.init);
+  }
+  u.elements = vectorMemoryUsage(es_);
+  for (const auto& eseg : es_) {
+    u.elements += instructionsMemoryUsage(eseg.offset);
+    u.elements += vectorMemoryUsage(eseg.init);
+  }
+  u.data = vectorMemoryUsage(ds_);
+  for (const auto& dseg : ds_) {
+    u.data += instructionsMemoryUsage(dseg.offset);
+    u.data += vectorMemoryUsage(dseg.init);
+  }
+  u.code = vectorMemoryUsage(cs_);
+  u.code += vectorMemoryUsage(code_sources_);
+  u.code += vectorMemoryUsage(detached_code_.value);
+  u.funcs.reserve(cs_.size());
+  for (const auto& c : cs_) {
+    MemoryUsage f{sizeof(Func), sizeof(Func)};
+    f += vectorMemoryUsage(c.code->locals);
+    f += vectorMemoryUsage(c.code->frame.slots);
+    f += instructionsMemoryUsage(c.code->expr);
+    u.funcs.emplace_back(f);
+  }
+  u.code_offsets = code_offsets_.memoryUsage();
+  u.incremental = vectorMemoryUsage(body_hashes_);
+  u.incremental += vectorMemoryUsage(changed_funcs_);
+  u.incremental += hashMapMemoryUsage(previous_bodies_);
+  return u;
 }
 
 bool InstructionDecoder::decodeGlobalSection(RawBufferGlobalSection* gs) {
   idx_ = 0;
   target_section_ = gs;
+  reserveEntries(&gs_);
   while (idx_ < target_section_->value.size()) {
     Global g;
+    if (gs_.size() < spare_gs_.size()) {
+      reuseStorage(&spare_gs_[gs_.size()].init, &g.init);
+    }
     if (decodeGlobalType(&g.type) < 0) {
       return false;
     }
     if (decodeExpr(&g.init) < 0) {
       return false;
     }
-    gs_.emplace_back(g);
+    gs_.emplace_back(std::move(g));
   }
   target_section_ = nullptr;
   return true;
@@ -123,26 +462,53 @@ bool InstructionDecoder::decodeGlobalSection(RawBufferGlobalSection* gs) {
 bool InstructionDecoder::decodeElementSection(RawBufferElementSection* es) {
   idx_ = 0;
   target_section_ = es;
+  reserveEntries(&es_);
   while (idx_ < target_section_->value.size()) {
     ElementSegment eseg;
-    if (decodeU32Integer(&eseg.table) < 0) {
+    if (es_.size() < spare_es_.size()) {
+      auto& spare = spare_es_[es_.size()];
+      reuseStorage(&spare.offset, &eseg.offset);
+      reuseStorage(&spare.init, &eseg.init);
+    }
+    uint32_t flags;
+    if (decodeU32Integer(&flags) < 0) {
       return false;
     }
-    if (decodeExpr(&eseg.offset) < 0) {
+    // Bit 0 marks passive or declarative segments, bit 1 an explicit table
+    // index (active) or declarative (otherwise). Segments of expressions
+    // (bit 2) are not supported.
+    if (flags > 0x03) {
       return false;
     }
+    if ((flags & 0x01) == 0) {
+      if ((flags & 0x02) != 0 && decodeU32Integer(&eseg.table) < 0) {
+        return false;
+      }
+      if (decodeExpr(&eseg.offset) < 0) {
+        return false;
+      }
+    } else {
+      eseg.mode = (flags & 0x02) != 0 ? ElementSegment::Mode::Declarative
+                                      : ElementSegment::Mode::Passive;
+    }
+    if (flags != 0x00) {
+      eseg.elem_kind = *fetchByte();
+      if (eseg.elem_kind != 0x00) {
+        return false;
+      }
+      ++idx_;
+    }
     uint32_t vec_size = fetchVecSize();
-    std::vector<uint32_t> init;
+    reserveEntries(&eseg.init, vec_size);
     while (vec_size > 0) {
       uint32_t num;
       if (decodeU32Integer(&num) < 0) {
         return false;
       }
-      init.emplace_back(num);
+      eseg.init.emplace_back(num);
       --vec_size;
     }
-    eseg.init = init;
-    es_.emplace_back(eseg);
+    es_.emplace_back(std::move(eseg));
   }
   target_section_ = nullptr;
   return true;
@@ -151,45 +517,294 @@ bool InstructionDecoder::decodeElementSection(RawBufferElementSection* es) {
 bool InstructionDecoder::decodeDataSection(RawBufferDataSection* ds) {
   idx_ = 0;
   target_section_ = ds;
+  reserveEntries(&ds_);
   while (idx_ < target_section_->value.size()) {
     DataSegment dseg;
-    if (decodeU32Integer(&dseg.data) < 0) {
+    if (ds_.size() < spare_ds_.size()) {
+      auto& spare = spare_ds_[ds_.size()];
+      reuseStorage(&spare.offset, &dseg.offset);
+      reuseStorage(&spare.init, &dseg.init);
+    }
+    uint32_t flags;
+    if (decodeU32Integer(&flags) < 0) {
       return false;
     }
-    if (decodeExpr(&dseg.offset) < 0) {
+    if (flags == 0x01) {
+      dseg.mode = DataSegment::Mode::Passive;
+    } else if (flags == 0x00 || flags == 0x02) {
+      if (flags == 0x02 && decodeU32Integer(&dseg.data) < 0) {
+        return false;
+      }
+      if (decodeExpr(&dseg.offset) < 0) {
+        return false;
+      }
+    } else {
       return false;
     }
     uint32_t vec_size = fetchVecSize();
-    std::vector<Byte> init;
-    while (vec_size > 0) {
-      init.emplace_back(*fetchByte());
-      ++idx_;
-      --vec_size;
+    if (vec_size > target_section_->value.size() - idx_) {
+      return false;
     }
-    dseg.init = init;
-    ds_.emplace_back(dseg);
+    const Byte* init = target_section_->value.data() + idx_;
+    dseg.init.assign(init, init + vec_size);
+    idx_ += vec_size;
+    ds_.emplace_back(std::move(dseg));
   }
   target_section_ = nullptr;
   return true;
 }
 
 bool InstructionDecoder::decodeCodeSection(RawBufferCodeSection* cs) {
+  if (options_.pool != nullptr && !options_.record_code_offsets) {
+    return decodeCodeSectionParallel(cs);
+  }
   idx_ = 0;
   target_section_ = cs;
+  reserveEntries(&cs_);
   while (idx_ < target_section_->value.size()) {
+    size_t entry_start = idx_;
     Code c;
     if (decodeU32Integer(&c.size) < 0) {
       return false;
     }
-    if (decodeFunc(&c.code) < 0) {
+    size_t body_start = idx_;
+    const FuncType* type = effects_.funcType(
+        imported_func_count_ + static_cast<uint32_t>(cs_.size()));
+    if (type == nullptr) {
+      return false;
+    }
+    uint64_t hash = 0;
+    Byte* body = nullptr;
+    if (options_.incremental || options_.store != nullptr) {
+      if (idx_ + c.size > target_section_->value.size()) {
+        return false;
+      }
+      body = target_section_->value.data() + idx_;
+      hash = hashBytes(body, c.size);
+    }
+    if (options_.incremental) {
+      body_hashes_.emplace_back(hash);
+      if (reuseFunc(hash, body, &c)) {
+        if (!updateFrame(*type, &c)) {
+          return false;
+        }
+        idx_ += c.size;
+        addCode(std::move(c), entry_start, body_start);
+        continue;
+      }
+      changed_funcs_.emplace_back(imported_func_count_ +
+                                  static_cast<uint32_t>(cs_.size()));
+    }
+    // Offsets are only known after decoding, so a stored body can't be used
+    // while they are being recorded.
+    if (options_.store != nullptr && !options_.record_code_offsets) {
+      c.code = options_.store->find(hash, body, c.size);
+      if (c.code != nullptr) {
+        if (!updateFrame(*type, &c)) {
+          return false;
+        }
+        idx_ += c.size;
+        addCode(std::move(c), entry_start, body_start);
+        continue;
+      }
+    }
+    if (options_.record_code_offsets) {
+      code_offsets_.beginFunc(moduleOffset());
+      recording_instructions_ = true;
+    }
+    // Bodies interned through the store are owned by it.
+    Func stored;
+    std::shared_ptr<Func> owned =
+        options_.store == nullptr ? newFunc() : nullptr;
+    Func* f = owned != nullptr ? owned.get() : &stored;
+    if (decodeFunc(f, *type) < 0) {
+      return false;
+    }
+    if (options_.record_code_offsets) {
+      recording_instructions_ = false;
+      code_offsets_.endFunc(moduleOffset());
+    }
+    if (options_.store != nullptr) {
+      c.code = options_.store->intern(hash, body, c.size, std::move(*f));
+      if (!updateFrame(*type, &c)) {
+        return false;
+      }
+    } else {
+      c.code = std::move(owned);
+    }
+    addCode(std::move(c), entry_start, body_start);
+  }
+  target_section_ = nullptr;
+  return true;
+}
+
+bool InstructionDecoder::decodeCodeSectionParallel(RawBufferCodeSection* cs) {
+  idx_ = 0;
+  target_section_ = cs;
+  std::vector<CodeEntry> entries;
+  reserveEntries(&entries);
+  while (idx_ < target_section_->value.size()) {
+    CodeEntry e{};
+    e.start = idx_;
+    if (decodeU32Integer(&e.code.size) < 0) {
+      return false;
+    }
+    e.body_start = idx_;
+    if (e.code.size > target_section_->value.size() - idx_) {
+      return false;
+    }
+    idx_ += e.code.size;
+    entries.emplace_back(std::move(e));
+  }
+  // Recycled Funcs are taken up front, as newFunc isn't thread-safe.
+  std::vector<std::shared_ptr<Func>> funcs(entries.size());
+  if (options_.store == nullptr) {
+    for (auto& f : funcs) {
+      f = newFunc();
+    }
+  }
+
+  // Entries are decoded in contiguous chunks, a few per thread to balance
+  // bodies of different sizes, each chunk with a cursor of its own.
+  size_t n = entries.size();
+  size_t chunks = std::min(n, options_.pool->size() * 4);
+  std::unique_ptr<bool[]> decoded(new bool[chunks]());
+  options_.pool->parallelFor(chunks, [&](size_t chunk) {
+    InstructionDecoder cursor;
+    cursor.target_section_ = cs;
+    cursor.options_.max_block_depth = options_.max_block_depth;
+    cursor.effects_ = effects_;
+    cursor.imported_func_count_ = imported_func_count_;
+    cursor.memory64_ = memory64_;
+    bool ok = true;
+    for (size_t k = chunk * n / chunks; ok && k < (chunk + 1) * n / chunks;
+         ++k) {
+      ok = decodeCodeEntry(&cursor, static_cast<uint32_t>(k),
+                           std::move(funcs[k]), &entries[k]);
+    }
+    decoded[chunk] = ok;
+  });
+  for (size_t chunk = 0; chunk < chunks; ++chunk) {
+    if (!decoded[chunk]) {
       return false;
     }
-    cs_.emplace_back(c);
+  }
+
+  for (size_t k = 0; k < n; ++k) {
+    auto& e = entries[k];
+    if (options_.incremental) {
+      body_hashes_.emplace_back(e.hash);
+      if (!e.reused) {
+        changed_funcs_.emplace_back(imported_func_count_ +
+                                    static_cast<uint32_t>(k));
+      }
+    }
+    addCode(std::move(e.code), e.start, e.body_start);
   }
   target_section_ = nullptr;
   return true;
 }
 
+bool InstructionDecoder::decodeCodeEntry(InstructionDecoder* cursor,
+                                         uint32_t k, std::shared_ptr<Func> f,
+                                         CodeEntry* e) {
+  const FuncType* type = effects_.funcType(imported_func_count_ + k);
+  if (type == nullptr) {
+    return false;
+  }
+  Code& c = e->code;
+  const Byte* body = target_section_->value.data() + e->body_start;
+  if (options_.incremental || options_.store != nullptr) {
+    e->hash = hashBytes(body, c.size);
+  }
+  if (options_.incremental && reuseFunc(e->hash, body, &c)) {
+    e->reused = true;
+    return cursor->updateFrame(*type, &c);
+  }
+  if (options_.store != nullptr) {
+    c.code = options_.store->find(e->hash, body, c.size);
+    if (c.code != nullptr) {
+      return cursor->updateFrame(*type, &c);
+    }
+  }
+  Func stored;
+  cursor->idx_ = e->body_start;
+  if (cursor->decodeFunc(f != nullptr ? f.get() : &stored, *type) < 0 ||
+      cursor->idx_ != e->body_start + c.size) {
+    return false;
+  }
+  if (options_.store != nullptr) {
+    c.code = options_.store->intern(e->hash, body, c.size, std::move(stored));
+    return cursor->updateFrame(*type, &c);
+  }
+  c.code = std::move(f);
+  return true;
+}
+
+void InstructionDecoder::addCode(Code c, size_t entry_start,
+                                 size_t body_start) {
+  code_sources_.push_back({c.code, entry_start, body_start + c.size});
+  cs_.emplace_back(std::move(c));
+}
+
+void InstructionDecoder::takeCode(Module* m) {
+  // A second transformation finds the section already detached.
+  if (!m->code_sec.value.empty()) {
+    detached_code_ = std::move(m->code_sec);
+  }
+  m->code_sec = RawBufferCodeSection{};
+}
+
+void InstructionDecoder::detachCode(Module* m) {
+  takeCode(m);
+  code_offsets_ = CodeOffsetIndex{};
+  body_hashes_.clear();
+  changed_funcs_.clear();
+}
+
+bool InstructionDecoder::reuseFunc(uint64_t hash, const Byte* body,
+                                   Code* c) {
+  if (options_.previous == nullptr) {
+    return false;
+  }
+  auto it = previous_bodies_.find(hash);
+  if (it == previous_bodies_.end()) {
+    return false;
+  }
+  const auto& prev = *options_.previous;
+  const auto& prev_code = prev.cs_[it->second];
+  const auto& prev_source = prev.code_sources_[it->second];
+  // The hash isn't keyed, so a colliding body can be crafted.
+  if (prev_code.size != c->size ||
+      prev_source.end > prev.detached_code_.value.size() ||
+      std::memcmp(prev.detached_code_.value.data() + prev_source.end - c->size,
+                  body, c->size) != 0) {
+    return false;
+  }
+  if (options_.record_code_offsets &&
+      !code_offsets_.copyFunc(prev.code_offsets_,
+                              prev.imported_func_count_ + it->second,
+                              moduleOffset())) {
+    // Offsets can't be carried over, so decode the body to record them.
+    return false;
+  }
+  c->code = prev_code.code;
+  return true;
+}
+
+bool InstructionDecoder::updateFrame(const FuncType& type, Code* c) {
+  Func::Frame frame;
+  if (!effects_.frame(type, *c->code, &frame)) {
+    return false;
+  }
+  if (frame != c->code->frame) {
+    Func f = *c->code;
+    f.frame = std::move(frame);
+    c->code = std::make_shared<const Func>(std::move(f));
+  }
+  return true;
+}
+
 int32_t InstructionDecoder::decodeValueType(ValueType* vt) {
   size_t start_idx = idx_;
   if (*fetchByte() == 0x7F) {
@@ -200,6 +815,8 @@ int32_t InstructionDecoder::decodeValueType(ValueType* vt) {
     *vt = ValueType::F32;
   } else if (*fetchByte() == 0x7C) {
     *vt = ValueType::F64;
+  } else if (*fetchByte() == 0x7B) {
+    *vt = ValueType::V128;
   } else {
     return -1;
   }
@@ -207,9 +824,10 @@ int32_t InstructionDecoder::decodeValueType(ValueType* vt) {
   return idx_ - start_idx;
 }
 
-int32_t InstructionDecoder::decodeFunc(Func* f) {
+int32_t InstructionDecoder::decodeFunc(Func* f, const FuncType& type) {
   size_t start_idx = idx_;
   auto vec_size = fetchVecSize();
+  reserveEntries(&f->locals, vec_size);
   while (vec_size > 0) {
     Func::Local l;
     if (decodeLocals(&l) < 0) {
@@ -221,6 +839,9 @@ int32_t InstructionDecoder::decodeFunc(Func* f) {
   if (decodeExpr(&f->expr) < 0) {
     return -1;
   }
+  if (!effects_.frame(type, *f, &f->frame)) {
+    return -1;
+  }
   return idx_ - start_idx;
 }
 
@@ -237,7 +858,19 @@ int32_t InstructionDecoder::decodeLocals(Func::Local* l) {
 
 int32_t InstructionDecoder::decodeU32Integer(uint32_t* idx) {
   size_t start_idx = idx_;
-  auto res = decodeULEB128(fetchByte(), idx);
+  auto res = decodeULEB128(target_section_->value.data() + idx_,
+                           target_section_->value.size() - idx_, idx);
+  if (res == 0) {
+    return -1;
+  }
+  idx_ += res;
+  return idx_ - start_idx;
+}
+
+int32_t InstructionDecoder::decodeU64Integer(uint64_t* idx) {
+  size_t start_idx = idx_;
+  auto res = decodeULEB128(target_section_->value.data() + idx_,
+                           target_section_->value.size() - idx_, idx);
   if (res == 0) {
     return -1;
   }
@@ -247,7 +880,8 @@ int32_t InstructionDecoder::decodeU32Integer(uint32_t* idx) {
 
 int32_t InstructionDecoder::decodeI32Integer(int32_t* idx) {
   size_t start_idx = idx_;
-  auto res = decodeSLEB128(fetchByte(), idx);
+  auto res = decodeSLEB128(target_section_->value.data() + idx_,
+                           target_section_->value.size() - idx_, idx);
   if (res == 0) {
     return -1;
   }
@@ -257,7 +891,8 @@ int32_t InstructionDecoder::decodeI32Integer(int32_t* idx) {
 
 int32_t InstructionDecoder::decodeI64Integer(int64_t* idx) {
   size_t start_idx = idx_;
-  auto res = decodeSLEB128(fetchByte(), idx);
+  auto res = decodeSLEB128(target_section_->value.data() + idx_,
+                           target_section_->value.size() - idx_, idx);
   if (res == 0) {
     return -1;
   }
@@ -267,11 +902,12 @@ int32_t InstructionDecoder::decodeI64Integer(int64_t* idx) {
 
 int32_t InstructionDecoder::decodeS33AsI64(int64_t* idx) {
   size_t start_idx = idx_;
-  auto res = decodeS33LEB128(fetchByte(), idx);
+  auto res = decodeS33LEB128(target_section_->value.data() + idx_,
+                             target_section_->value.size() - idx_, idx);
   if (res == 0) {
     return -1;
   }
-  idx += res;
+  idx_ += res;
   return idx_ - start_idx;
 }
 
@@ -293,19 +929,57 @@ int32_t InstructionDecoder::decodeGlobalType(GlobalType* gt) {
 
 int32_t InstructionDecoder::decodeExpr(std::vector<Instruction>* iseq) {
   size_t start_idx = idx_;
-  while (*fetchByte() != 0x0B) {
-    Instruction i;
+  // A block is decoded in place in the sequence of its parent, which doesn't
+  // grow until the block ends, so pointers into it stay valid.
+  open_blocks_.clear();
+  std::vector<Instruction>* current = iseq;
+  while (true) {
+    if (idx_ >= target_section_->value.size()) {
+      return -1;
+    }
+    if (*fetchByte() == 0x0B) {
+      ++idx_;
+      if (open_blocks_.empty()) {
+        break;
+      }
+      open_blocks_.pop_back();
+      current = open_blocks_.empty() ? iseq : open_blocks_.back().iseq;
+      continue;
+    }
+    if (*fetchByte() == 0x05 && !open_blocks_.empty()) {
+      auto& open = open_blocks_.back();
+      if (open.iseq == &open.block->else_instructions) {
+        return -1;
+      }
+      open.iseq = &open.block->else_instructions;
+      takeSpareSeq(open.iseq);
+      current = open.iseq;
+      ++idx_;
+      continue;
+    }
+    Instruction& i = current->emplace_back();
     if (decodeInstruction(&i) < 0) {
       return -1;
     }
-    iseq->emplace_back(i);
+    if (i.type == InstructionType::Block) {
+      if (open_blocks_.size() >=
+          std::min(options_.max_block_depth, MAX_BLOCK_DEPTH)) {
+        return -1;
+      }
+      open_blocks_.push_back(
+          {&i.block_instruction, &i.block_instruction.instructions});
+      current = open_blocks_.back().iseq;
+      takeSpareSeq(current);
+    }
   }
-  ++idx_;
   return idx_ - start_idx;
 }
 
 int32_t InstructionDecoder::decodeInstruction(Instruction* i) {
   size_t start_idx = idx_;
+  if (recording_instructions_) {
+    code_offsets_.addInstruction(moduleOffset());
+  }
   if (0x28 <= *fetchByte() && *fetchByte() <= 0x3E) {
     BasicMemoryInstruction bmi;
     if (decodeBasicMemoryInstruction(&bmi) < 0) {
@@ -342,13 +1016,11 @@ int32_t InstructionDecoder::decodeInstruction(Instruction* i) {
     i->type = InstructionType::Variable;
     i->variable_instruction = vi;
   } else if (0x02 <= *fetchByte() && *fetchByte() <= 0x04) {
-    BlockInstruction bi;
-    if (decodeBlockInstruction(&bi) < 0) {
+    if (decodeBlockInstruction(&i->block_instruction) < 0) {
       return -1;
     }
     i->type = InstructionType::Block;
-    i->block_instruction = bi;
-  } else if (0x0C <= *fetchByte() && *fetchByte() <= 0x0E) {
+  } else if (0x0C <= *fetchByte() && *fetchByte() <= 0x0D) {
     BranchInstruction bi;
     if (decodeBranchInstruction(&bi) < 0) {
       return -1;
@@ -356,12 +1028,10 @@ int32_t InstructionDecoder::decodeInstruction(Instruction* i) {
     i->type = InstructionType::Branch;
     i->branch_instruction = bi;
   } else if (0x0E == *fetchByte()) {
-    TableBranchInstruction tbi;
-    if (decodeTableBranchInstruction(&tbi) < 0) {
+    if (decodeTableBranchInstruction(&i->table_branch_instruction) < 0) {
       return -1;
     }
     i->type = InstructionType::TableBranch;
-    i->table_branch_instruction = tbi;
   } else if (0x10 <= *fetchByte() && *fetchByte() <= 0x11) {
     CallInstruction ci;
     if (decodeCallInstruction(&ci) < 0) {
@@ -394,8 +1064,23 @@ int32_t InstructionDecoder::decodeInstruction(Instruction* i) {
     i->type = InstructionType::SingleOperandControl;
     i->single_operand_control_instruction = s;
     ++idx_;
+  } else if (0xFD == *fetchByte()) {
+    if (decodeSimdInstruction(i) < 0) {
+      return -1;
+    }
+  } else if (0xFC == *fetchByte()) {
+    if (decodeMiscInstruction(i) < 0) {
+      return -1;
+    }
+  } else if (0xFE == *fetchByte()) {
+    AtomicInstruction ai{};
+    if (decodeAtomicInstruction(&ai) < 0) {
+      return -1;
+    }
+    i->type = InstructionType::Atomic;
+    i->atomic_instruction = ai;
   } else {
-    assert(false);
+    return -1;
   }
   return idx_ - start_idx;
 }
@@ -424,7 +1109,15 @@ int32_t InstructionDecoder::decodeNumericConstInstruction(
       }
       break;
     case NumericConstInstruction::Type::F32_CONST:
+      if (decodeFixedWidth(&nci->f32_value) < 0) {
+        return -1;
+      }
+      break;
     case NumericConstInstruction::Type::F64_CONST:
+      if (decodeFixedWidth(&nci->f64_value) < 0) {
+        return -1;
+      }
+      break;
     default:
       throw std::runtime_error("Not supported instruction has appeared");
   }
@@ -447,6 +1140,11 @@ int32_t InstructionDecoder::decodeMemorySizeInstruction(
   size_t start_idx = idx_;
   msi->type = static_cast<MemorySizeInstruction::Type>(*fetchByte());
   ++idx_;
+  // Reserved memory index byte.
+  if (*fetchByte() != 0x00) {
+    return -1;
+  }
+  ++idx_;
   return idx_ - start_idx;
 }
 
@@ -456,7 +1154,10 @@ int32_t InstructionDecoder::decodeMemoryArgument(
   if (decodeU32Integer(&arg->align) < 0) {
     return -1;
   }
-  if (decodeU32Integer(&arg->offset) < 0) {
+  if (decodeU64Integer(&arg->offset) < 0) {
+    return -1;
+  }
+  if (!memory64_ && arg->offset > std::numeric_limits<uint32_t>::max()) {
     return -1;
   }
   return idx_ - start_idx;
@@ -508,31 +1209,6 @@ int32_t InstructionDecoder::decodeBlockInstruction(BlockInstruction* bi) {
   if (decodeBlockType(bi) < 0) {
     return -1;
   }
-  std::vector<Instruction> iseq;
-  bool is_else = false;
-else_block:
-  while (true) {
-    if (*fetchByte() == 0x0B) {
-      if (is_else) {
-        bi->else_instructions = iseq;
-      } else {
-        bi->instructions = iseq;
-      }
-      break;
-    }
-    if (*fetchByte() == 0x05) {
-      bi->instructions = iseq;
-      iseq.clear();
-      is_else = true;
-      goto else_block;
-    }
-    Instruction i;
-    if (decodeInstruction(&i) < 0) {
-      return -1;
-    }
-    iseq.emplace_back(i);
-  }
-  ++idx_;
   return idx_ - start_idx;
 }
 
@@ -551,13 +1227,14 @@ int32_t InstructionDecoder::decodeTableBranchInstruction(
   size_t start_idx = idx_;
   ++idx_;
   auto vec_size = fetchVecSize();
-  std::vector<uint32_t> label_idxs;
+  tbi->l.clear();
+  reserveEntries(&tbi->l, vec_size);
   while (vec_size > 0) {
     uint32_t label_idx;
     if (decodeU32Integer(&label_idx) < 0) {
       return -1;
     }
-    label_idxs.emplace_back(label_idx);
+    tbi->l.emplace_back(label_idx);
     --vec_size;
   }
   if (decodeU32Integer(&tbi->ln) < 0) {
@@ -582,6 +1259,149 @@ int32_t InstructionDecoder::decodeCallInstruction(CallInstruction* ci) {
   return idx_ - start_idx;
 }
 
+int32_t InstructionDecoder::decodeSimdInstruction(Instruction* i) {
+  size_t start_idx = idx_;
+  ++idx_;
+  uint32_t op;
+  if (decodeU32Integer(&op) < 0) {
+    return -1;
+  }
+  if (op == 0x0C || op == 0x0D) {
+    V128 bytes;
+    if (decodeFixedWidth(&bytes) < 0) {
+      return -1;
+    }
+    if (op == 0x0C) {
+      i->type = InstructionType::SimdConst;
+      i->simd_const_instruction.value = bytes;
+    } else {
+      i->type = InstructionType::SimdShuffle;
+      i->simd_shuffle_instruction.lanes = bytes;
+    }
+    return idx_ - start_idx;
+  }
+  switch (op) {
+    // Opcodes which are reserved in the SIMD proposal.
+    case 0x9A:
+    case 0xA2:
+    case 0xA5:
+    case 0xA6:
+    case 0xAF:
+    case 0xB0:
+    case 0xB2:
+    case 0xB3:
+    case 0xB4:
+    case 0xBB:
+    case 0xC2:
+    case 0xC5:
+    case 0xC6:
+    case 0xCF:
+    case 0xD0:
+    case 0xD2:
+    case 0xD3:
+    case 0xD4:
+    case 0xE2:
+    case 0xEE:
+      return -1;
+    default:
+      if (op > 0xFF) {
+        return -1;
+      }
+  }
+  SimdInstruction si{};
+  si.type = static_cast<SimdInstruction::Type>(op);
+  if (SimdInstruction::hasMemoryArgument(op) &&
+      decodeMemoryArgument(&si.arg) < 0) {
+    return -1;
+  }
+  // Lane indices are a byte wide, and like the 16-byte immediates above are
+  // checked against the end of the section.
+  if (SimdInstruction::hasLane(op) && decodeFixedWidth(&si.lane) < 0) {
+    return -1;
+  }
+  i->type = InstructionType::Simd;
+  i->simd_instruction = si;
+  return idx_ - start_idx;
+}
+
+int32_t InstructionDecoder::decodeMiscInstruction(Instruction* i) {
+  size_t start_idx = idx_;
+  ++idx_;
+  uint32_t op;
+  if (decodeU32Integer(&op) < 0) {
+    return -1;
+  }
+  if (op <= 0x07) {
+    i->type = InstructionType::SaturatingTruncation;
+    i->saturating_truncation_instruction.type =
+        static_cast<SaturatingTruncationInstruction::Type>(op);
+    return idx_ - start_idx;
+  }
+  if (op > 0x11) {
+    return -1;
+  }
+  BulkMemoryInstruction bmi{};
+  bmi.type = static_cast<BulkMemoryInstruction::Type>(op);
+  switch (bmi.type) {
+    case BulkMemoryInstruction::Type::MEMORY_INIT:
+    case BulkMemoryInstruction::Type::TABLE_INIT:
+      if (decodeU32Integer(&bmi.segment_idx) < 0 ||
+          decodeU32Integer(&bmi.dst_idx) < 0) {
+        return -1;
+      }
+      break;
+    case BulkMemoryInstruction::Type::DATA_DROP:
+    case BulkMemoryInstruction::Type::ELEM_DROP:
+      if (decodeU32Integer(&bmi.segment_idx) < 0) {
+        return -1;
+      }
+      break;
+    case BulkMemoryInstruction::Type::MEMORY_COPY:
+    case BulkMemoryInstruction::Type::TABLE_COPY:
+      if (decodeU32Integer(&bmi.dst_idx) < 0 ||
+          decodeU32Integer(&bmi.src_idx) < 0) {
+        return -1;
+      }
+      break;
+    case BulkMemoryInstruction::Type::MEMORY_FILL:
+    case BulkMemoryInstruction::Type::TABLE_GROW:
+    case BulkMemoryInstruction::Type::TABLE_SIZE:
+    case BulkMemoryInstruction::Type::TABLE_FILL:
+      if (decodeU32Integer(&bmi.dst_idx) < 0) {
+        return -1;
+      }
+      break;
+  }
+  i->type = InstructionType::BulkMemory;
+  i->bulk_memory_instruction = bmi;
+  return idx_ - start_idx;
+}
+
+int32_t InstructionDecoder::decodeAtomicInstruction(AtomicInstruction* ai) {
+  size_t start_idx = idx_;
+  ++idx_;
+  uint32_t op;
+  if (decodeU32Integer(&op) < 0) {
+    return -1;
+  }
+  if ((0x04 <= op && op <= 0x0F) || op > 0x4E) {
+    return -1;
+  }
+  ai->type = static_cast<AtomicInstruction::Type>(op);
+  if (ai->type == AtomicInstruction::Type::ATOMIC_FENCE) {
+    // Reserved byte for the memory ordering.
+    if (*fetchByte() != 0x00) {
+      return -1;
+    }
+    ++idx_;
+    return idx_ - start_idx;
+  }
+  if (decodeMemoryArgument(&ai->arg) < 0) {
+    return -1;
+  }
+  return idx_ - start_idx;
+}
+
 }  // namespace wasmparser
 
 #endif  // WASMPARSER_CPP_INSTRUCTION_DECODER_H
@@ -27,6 +27,11 @@
 #ifndef WASMPARSER_CPP_INSTRUCTIONS_H
 #define WASMPARSER_CPP_INSTRUCTIONS_H
 
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
 #include "types.h"
 
 namespace wasmparser {
@@ -42,6 +47,12 @@ enum class InstructionType {
   MemorySize,
   Numeric,
   NumericConst,
+  Simd,
+  SimdConst,
+  SimdShuffle,
+  SaturatingTruncation,
+  BulkMemory,
+  Atomic,
 };
 
 struct Instruction;
@@ -53,6 +64,13 @@ struct SingleOperandControlInstruction {
     RETURN = 0x0F,
   };
   Type type;
+
+  bool operator==(const SingleOperandControlInstruction& o) const {
+    return type == o.type;
+  }
+  bool operator!=(const SingleOperandControlInstruction& o) const {
+    return !(*this == o);
+  }
 };
 
 struct BlockInstruction {
@@ -74,6 +92,9 @@ struct BlockInstruction {
   };
   std::vector<Instruction> instructions;
   std::vector<Instruction> else_instructions;
+
+  bool operator==(const BlockInstruction& o) const;
+  bool operator!=(const BlockInstruction& o) const { return !(*this == o); }
 };
 
 struct BranchInstruction {
@@ -83,11 +104,25 @@ struct BranchInstruction {
   };
   Type type;
   uint32_t index;
+
+  bool operator==(const BranchInstruction& o) const {
+    return type == o.type && index == o.index;
+  }
+  bool operator!=(const BranchInstruction& o) const { return !(*this == o); }
 };
 
 struct TableBranchInstruction {
-  std::vector<uint32_t> l;
+  // Two labels fit inline in the space of a std::vector, so that the common
+  // short br_tables don't allocate without growing Instruction.
+  SmallVector<uint32_t, 2> l;
   uint32_t ln;
+
+  bool operator==(const TableBranchInstruction& o) const {
+    return l == o.l && ln == o.ln;
+  }
+  bool operator!=(const TableBranchInstruction& o) const {
+    return !(*this == o);
+  }
 };
 
 struct CallInstruction {
@@ -97,6 +132,11 @@ struct CallInstruction {
   };
   Type type;
   uint32_t index;
+
+  bool operator==(const CallInstruction& o) const {
+    return type == o.type && index == o.index;
+  }
+  bool operator!=(const CallInstruction& o) const { return !(*this == o); }
 };
 
 struct ParametricInstruction {
@@ -105,6 +145,13 @@ struct ParametricInstruction {
     SELECT = 0x1B,
   };
   Type type;
+
+  bool operator==(const ParametricInstruction& o) const {
+    return type == o.type;
+  }
+  bool operator!=(const ParametricInstruction& o) const {
+    return !(*this == o);
+  }
 };
 
 struct VariableInstruction {
@@ -117,6 +164,11 @@ struct VariableInstruction {
   };
   Type type;
   uint32_t idx;
+
+  bool operator==(const VariableInstruction& o) const {
+    return type == o.type && idx == o.idx;
+  }
+  bool operator!=(const VariableInstruction& o) const { return !(*this == o); }
 };
 
 struct BasicMemoryInstruction {
@@ -148,9 +200,21 @@ struct BasicMemoryInstruction {
   Type type;
   struct MemoryArgument {
     uint32_t align;
-    uint32_t offset;
+    // u64 for memory64 memories, otherwise always fits in 32 bits.
+    uint64_t offset;
+
+    bool operator==(const MemoryArgument& o) const {
+      return align == o.align && offset == o.offset;
+    }
   };
   MemoryArgument arg;
+
+  bool operator==(const BasicMemoryInstruction& o) const {
+    return type == o.type && arg == o.arg;
+  }
+  bool operator!=(const BasicMemoryInstruction& o) const {
+    return !(*this == o);
+  }
 };
 
 struct MemorySizeInstruction {
@@ -159,6 +223,13 @@ struct MemorySizeInstruction {
     MEMORY_GLOW = 0x40,
   };
   Type type;
+
+  bool operator==(const MemorySizeInstruction& o) const {
+    return type == o.type;
+  }
+  bool operator!=(const MemorySizeInstruction& o) const {
+    return !(*this == o);
+  }
 };
 
 struct NumericConstInstruction {
@@ -175,6 +246,11 @@ struct NumericConstInstruction {
     float f32_value;
     double f64_value;
   };
+
+  bool operator==(const NumericConstInstruction& o) const;
+  bool operator!=(const NumericConstInstruction& o) const {
+    return !(*this == o);
+  }
 };
 
 struct NumericInstruction {
@@ -309,8 +385,450 @@ struct NumericInstruction {
     I64_EXTEND32_S = 0xC4,
   };
   Type type;
+
+  bool operator==(const NumericInstruction& o) const { return type == o.type; }
+  bool operator!=(const NumericInstruction& o) const { return !(*this == o); }
+};
+
+// 0xFC-prefixed non-trapping float-to-int conversions.
+struct SaturatingTruncationInstruction {
+  enum class Type : Byte {
+    I32_TRUNC_SAT_F32_S = 0x00,
+    I32_TRUNC_SAT_F32_U = 0x01,
+    I32_TRUNC_SAT_F64_S = 0x02,
+    I32_TRUNC_SAT_F64_U = 0x03,
+    I64_TRUNC_SAT_F32_S = 0x04,
+    I64_TRUNC_SAT_F32_U = 0x05,
+    I64_TRUNC_SAT_F64_S = 0x06,
+    I64_TRUNC_SAT_F64_U = 0x07,
+  };
+  Type type;
+
+  bool operator==(const SaturatingTruncationInstruction& o) const {
+    return type == o.type;
+  }
+  bool operator!=(const SaturatingTruncationInstruction& o) const {
+    return !(*this == o);
+  }
 };
 
+// 0xFC-prefixed bulk memory and table instructions.
+struct BulkMemoryInstruction {
+  enum class Type : Byte {
+    MEMORY_INIT = 0x08,
+    DATA_DROP = 0x09,
+    MEMORY_COPY = 0x0A,
+    MEMORY_FILL = 0x0B,
+    TABLE_INIT = 0x0C,
+    ELEM_DROP = 0x0D,
+    TABLE_COPY = 0x0E,
+    TABLE_GROW = 0x0F,
+    TABLE_SIZE = 0x10,
+    TABLE_FILL = 0x11,
+  };
+  Type type;
+  // Data segment of memory.init and data.drop, element segment of
+  // table.init and elem.drop.
+  uint32_t segment_idx;
+  // Memory or table written to, or the only one accessed.
+  uint32_t dst_idx;
+  // Memory or table read by memory.copy and table.copy.
+  uint32_t src_idx;
+
+  bool operator==(const BulkMemoryInstruction& o) const {
+    return type == o.type && segment_idx == o.segment_idx &&
+           dst_idx == o.dst_idx && src_idx == o.src_idx;
+  }
+  bool operator!=(const BulkMemoryInstruction& o) const {
+    return !(*this == o);
+  }
+};
+
+// 0xFE-prefixed instructions of the threads proposal. atomic.fence has no
+// memory argument and leaves `arg` zeroed.
+struct AtomicInstruction {
+  enum class Type : Byte {
+    MEMORY_ATOMIC_NOTIFY = 0x00,
+    MEMORY_ATOMIC_WAIT32 = 0x01,
+    MEMORY_ATOMIC_WAIT64 = 0x02,
+    ATOMIC_FENCE = 0x03,
+    I32_ATOMIC_LOAD = 0x10,
+    I64_ATOMIC_LOAD = 0x11,
+    I32_ATOMIC_LOAD8_U = 0x12,
+    I32_ATOMIC_LOAD16_U = 0x13,
+    I64_ATOMIC_LOAD8_U = 0x14,
+    I64_ATOMIC_LOAD16_U = 0x15,
+    I64_ATOMIC_LOAD32_U = 0x16,
+    I32_ATOMIC_STORE = 0x17,
+    I64_ATOMIC_STORE = 0x18,
+    I32_ATOMIC_STORE8 = 0x19,
+    I32_ATOMIC_STORE16 = 0x1A,
+    I64_ATOMIC_STORE8 = 0x1B,
+    I64_ATOMIC_STORE16 = 0x1C,
+    I64_ATOMIC_STORE32 = 0x1D,
+    I32_ATOMIC_RMW_ADD = 0x1E,
+    I64_ATOMIC_RMW_ADD = 0x1F,
+    I32_ATOMIC_RMW8_ADD_U = 0x20,
+    I32_ATOMIC_RMW16_ADD_U = 0x21,
+    I64_ATOMIC_RMW8_ADD_U = 0x22,
+    I64_ATOMIC_RMW16_ADD_U = 0x23,
+    I64_ATOMIC_RMW32_ADD_U = 0x24,
+    I32_ATOMIC_RMW_SUB = 0x25,
+    I64_ATOMIC_RMW_SUB = 0x26,
+    I32_ATOMIC_RMW8_SUB_U = 0x27,
+    I32_ATOMIC_RMW16_SUB_U = 0x28,
+    I64_ATOMIC_RMW8_SUB_U = 0x29,
+    I64_ATOMIC_RMW16_SUB_U = 0x2A,
+    I64_ATOMIC_RMW32_SUB_U = 0x2B,
+    I32_ATOMIC_RMW_AND = 0x2C,
+    I64_ATOMIC_RMW_AND = 0x2D,
+    I32_ATOMIC_RMW8_AND_U = 0x2E,
+    I32_ATOMIC_RMW16_AND_U = 0x2F,
+    I64_ATOMIC_RMW8_AND_U = 0x30,
+    I64_ATOMIC_RMW16_AND_U = 0x31,
+    I64_ATOMIC_RMW32_AND_U = 0x32,
+    I32_ATOMIC_RMW_OR = 0x33,
+    I64_ATOMIC_RMW_OR = 0x34,
+    I32_ATOMIC_RMW8_OR_U = 0x35,
+    I32_ATOMIC_RMW16_OR_U = 0x36,
+    I64_ATOMIC_RMW8_OR_U = 0x37,
+    I64_ATOMIC_RMW16_OR_U = 0x38,
+    I64_ATOMIC_RMW32_OR_U = 0x39,
+    I32_ATOMIC_RMW_XOR = 0x3A,
+    I64_ATOMIC_RMW_XOR = 0x3B,
+    I32_ATOMIC_RMW8_XOR_U = 0x3C,
+    I32_ATOMIC_RMW16_XOR_U = 0x3D,
+    I64_ATOMIC_RMW8_XOR_U = 0x3E,
+    I64_ATOMIC_RMW16_XOR_U = 0x3F,
+    I64_ATOMIC_RMW32_XOR_U = 0x40,
+    I32_ATOMIC_RMW_XCHG = 0x41,
+    I64_ATOMIC_RMW_XCHG = 0x42,
+    I32_ATOMIC_RMW8_XCHG_U = 0x43,
+    I32_ATOMIC_RMW16_XCHG_U = 0x44,
+    I64_ATOMIC_RMW8_XCHG_U = 0x45,
+    I64_ATOMIC_RMW16_XCHG_U = 0x46,
+    I64_ATOMIC_RMW32_XCHG_U = 0x47,
+    I32_ATOMIC_RMW_CMPXCHG = 0x48,
+    I64_ATOMIC_RMW_CMPXCHG = 0x49,
+    I32_ATOMIC_RMW8_CMPXCHG_U = 0x4A,
+    I32_ATOMIC_RMW16_CMPXCHG_U = 0x4B,
+    I64_ATOMIC_RMW8_CMPXCHG_U = 0x4C,
+    I64_ATOMIC_RMW16_CMPXCHG_U = 0x4D,
+    I64_ATOMIC_RMW32_CMPXCHG_U = 0x4E,
+  };
+  Type type;
+  BasicMemoryInstruction::MemoryArgument arg;
+
+  bool operator==(const AtomicInstruction& o) const {
+    return type == o.type && arg == o.arg;
+  }
+  bool operator!=(const AtomicInstruction& o) const { return !(*this == o); }
+};
+
+// 0xFD-prefixed instructions, except for the two with 16-byte immediates which
+// are decoded into SimdConstInstruction and SimdShuffleInstruction. Keeping
+// those apart leaves this struct small enough for the Instruction union.
+struct SimdInstruction {
+  enum class Type : uint16_t {
+    V128_LOAD = 0x00,
+    V128_LOAD8X8_S = 0x01,
+    V128_LOAD8X8_U = 0x02,
+    V128_LOAD16X4_S = 0x03,
+    V128_LOAD16X4_U = 0x04,
+    V128_LOAD32X2_S = 0x05,
+    V128_LOAD32X2_U = 0x06,
+    V128_LOAD8_SPLAT = 0x07,
+    V128_LOAD16_SPLAT = 0x08,
+    V128_LOAD32_SPLAT = 0x09,
+    V128_LOAD64_SPLAT = 0x0A,
+    V128_STORE = 0x0B,
+    V128_CONST = 0x0C,
+    I8X16_SHUFFLE = 0x0D,
+    I8X16_SWIZZLE = 0x0E,
+    I8X16_SPLAT = 0x0F,
+    I16X8_SPLAT = 0x10,
+    I32X4_SPLAT = 0x11,
+    I64X2_SPLAT = 0x12,
+    F32X4_SPLAT = 0x13,
+    F64X2_SPLAT = 0x14,
+    I8X16_EXTRACT_LANE_S = 0x15,
+    I8X16_EXTRACT_LANE_U = 0x16,
+    I8X16_REPLACE_LANE = 0x17,
+    I16X8_EXTRACT_LANE_S = 0x18,
+    I16X8_EXTRACT_LANE_U = 0x19,
+    I16X8_REPLACE_LANE = 0x1A,
+    I32X4_EXTRACT_LANE = 0x1B,
+    I32X4_REPLACE_LANE = 0x1C,
+    I64X2_EXTRACT_LANE = 0x1D,
+    I64X2_REPLACE_LANE = 0x1E,
+    F32X4_EXTRACT_LANE = 0x1F,
+    F32X4_REPLACE_LANE = 0x20,
+    F64X2_EXTRACT_LANE = 0x21,
+    F64X2_REPLACE_LANE = 0x22,
+    I8X16_EQ = 0x23,
+    I8X16_NE = 0x24,
+    I8X16_LT_S = 0x25,
+    I8X16_LT_U = 0x26,
+    I8X16_GT_S = 0x27,
+    I8X16_GT_U = 0x28,
+    I8X16_LE_S = 0x29,
+    I8X16_LE_U = 0x2A,
+    I8X16_GE_S = 0x2B,
+    I8X16_GE_U = 0x2C,
+    I16X8_EQ = 0x2D,
+    I16X8_NE = 0x2E,
+    I16X8_LT_S = 0x2F,
+    I16X8_LT_U = 0x30,
+    I16X8_GT_S = 0x31,
+    I16X8_GT_U = 0x32,
+    I16X8_LE_S = 0x33,
+    I16X8_LE_U = 0x34,
+    I16X8_GE_S = 0x35,
+    I16X8_GE_U = 0x36,
+    I32X4_EQ = 0x37,
+    I32X4_NE = 0x38,
+    I32X4_LT_S = 0x39,
+    I32X4_LT_U = 0x3A,
+    I32X4_GT_S = 0x3B,
+    I32X4_GT_U = 0x3C,
+    I32X4_LE_S = 0x3D,
+    I32X4_LE_U = 0x3E,
+    I32X4_GE_S = 0x3F,
+    I32X4_GE_U = 0x40,
+    F32X4_EQ = 0x41,
+    F32X4_NE = 0x42,
+    F32X4_LT = 0x43,
+    F32X4_GT = 0x44,
+    F32X4_LE = 0x45,
+    F32X4_GE = 0x46,
+    F64X2_EQ = 0x47,
+    F64X2_NE = 0x48,
+    F64X2_LT = 0x49,
+    F64X2_GT = 0x4A,
+    F64X2_LE = 0x4B,
+    F64X2_GE = 0x4C,
+    V128_NOT = 0x4D,
+    V128_AND = 0x4E,
+    V128_ANDNOT = 0x4F,
+    V128_OR = 0x50,
+    V128_XOR = 0x51,
+    V128_BITSELECT = 0x52,
+    V128_ANY_TRUE = 0x53,
+    V128_LOAD8_LANE = 0x54,
+    V128_LOAD16_LANE = 0x55,
+    V128_LOAD32_LANE = 0x56,
+    V128_LOAD64_LANE = 0x57,
+    V128_STORE8_LANE = 0x58,
+    V128_STORE16_LANE = 0x59,
+    V128_STORE32_LANE = 0x5A,
+    V128_STORE64_LANE = 0x5B,
+    V128_LOAD32_ZERO = 0x5C,
+    V128_LOAD64_ZERO = 0x5D,
+    F32X4_DEMOTE_F64X2_ZERO = 0x5E,
+    F64X2_PROMOTE_LOW_F32X4 = 0x5F,
+    I8X16_ABS = 0x60,
+    I8X16_NEG = 0x61,
+    I8X16_POPCNT = 0x62,
+    I8X16_ALL_TRUE = 0x63,
+    I8X16_BITMASK = 0x64,
+    I8X16_NARROW_I16X8_S = 0x65,
+    I8X16_NARROW_I16X8_U = 0x66,
+    F32X4_CEIL = 0x67,
+    F32X4_FLOOR = 0x68,
+    F32X4_TRUNC = 0x69,
+    F32X4_NEAREST = 0x6A,
+    I8X16_SHL = 0x6B,
+    I8X16_SHR_S = 0x6C,
+    I8X16_SHR_U = 0x6D,
+    I8X16_ADD = 0x6E,
+    I8X16_ADD_SAT_S = 0x6F,
+    I8X16_ADD_SAT_U = 0x70,
+    I8X16_SUB = 0x71,
+    I8X16_SUB_SAT_S = 0x72,
+    I8X16_SUB_SAT_U = 0x73,
+    F64X2_CEIL = 0x74,
+    F64X2_FLOOR = 0x75,
+    I8X16_MIN_S = 0x76,
+    I8X16_MIN_U = 0x77,
+    I8X16_MAX_S = 0x78,
+    I8X16_MAX_U = 0x79,
+    F64X2_TRUNC = 0x7A,
+    I8X16_AVGR_U = 0x7B,
+    I16X8_EXTADD_PAIRWISE_I8X16_S = 0x7C,
+    I16X8_EXTADD_PAIRWISE_I8X16_U = 0x7D,
+    I32X4_EXTADD_PAIRWISE_I16X8_S = 0x7E,
+    I32X4_EXTADD_PAIRWISE_I16X8_U = 0x7F,
+    I16X8_ABS = 0x80,
+    I16X8_NEG = 0x81,
+    I16X8_Q15MULR_SAT_S = 0x82,
+    I16X8_ALL_TRUE = 0x83,
+    I16X8_BITMASK = 0x84,
+    I16X8_NARROW_I32X4_S = 0x85,
+    I16X8_NARROW_I32X4_U = 0x86,
+    I16X8_EXTEND_LOW_I8X16_S = 0x87,
+    I16X8_EXTEND_HIGH_I8X16_S = 0x88,
+    I16X8_EXTEND_LOW_I8X16_U = 0x89,
+    I16X8_EXTEND_HIGH_I8X16_U = 0x8A,
+    I16X8_SHL = 0x8B,
+    I16X8_SHR_S = 0x8C,
+    I16X8_SHR_U = 0x8D,
+    I16X8_ADD = 0x8E,
+    I16X8_ADD_SAT_S = 0x8F,
+    I16X8_ADD_SAT_U = 0x90,
+    I16X8_SUB = 0x91,
+    I16X8_SUB_SAT_S = 0x92,
+    I16X8_SUB_SAT_U = 0x93,
+    F64X2_NEAREST = 0x94,
+    I16X8_MUL = 0x95,
+    I16X8_MIN_S = 0x96,
+    I16X8_MIN_U = 0x97,
+    I16X8_MAX_S = 0x98,
+    I16X8_MAX_U = 0x99,
+    I16X8_AVGR_U = 0x9B,
+    I16X8_EXTMUL_LOW_I8X16_S = 0x9C,
+    I16X8_EXTMUL_HIGH_I8X16_S = 0x9D,
+    I16X8_EXTMUL_LOW_I8X16_U = 0x9E,
+    I16X8_EXTMUL_HIGH_I8X16_U = 0x9F,
+    I32X4_ABS = 0xA0,
+    I32X4_NEG = 0xA1,
+    I32X4_ALL_TRUE = 0xA3,
+    I32X4_BITMASK = 0xA4,
+    I32X4_EXTEND_LOW_I16X8_S = 0xA7,
+    I32X4_EXTEND_HIGH_I16X8_S = 0xA8,
+    I32X4_EXTEND_LOW_I16X8_U = 0xA9,
+    I32X4_EXTEND_HIGH_I16X8_U = 0xAA,
+    I32X4_SHL = 0xAB,
+    I32X4_SHR_S = 0xAC,
+    I32X4_SHR_U = 0xAD,
+    I32X4_ADD = 0xAE,
+    I32X4_SUB = 0xB1,
+    I32X4_MUL = 0xB5,
+    I32X4_MIN_S = 0xB6,
+    I32X4_MIN_U = 0xB7,
+    I32X4_MAX_S = 0xB8,
+    I32X4_MAX_U = 0xB9,
+    I32X4_DOT_I16X8_S = 0xBA,
+    I32X4_EXTMUL_LOW_I16X8_S = 0xBC,
+    I32X4_EXTMUL_HIGH_I16X8_S = 0xBD,
+    I32X4_EXTMUL_LOW_I16X8_U = 0xBE,
+    I32X4_EXTMUL_HIGH_I16X8_U = 0xBF,
+    I64X2_ABS = 0xC0,
+    I64X2_NEG = 0xC1,
+    I64X2_ALL_TRUE = 0xC3,
+    I64X2_BITMASK = 0xC4,
+    I64X2_EXTEND_LOW_I32X4_S = 0xC7,
+    I64X2_EXTEND_HIGH_I32X4_S = 0xC8,
+    I64X2_EXTEND_LOW_I32X4_U = 0xC9,
+    I64X2_EXTEND_HIGH_I32X4_U = 0xCA,
+    I64X2_SHL = 0xCB,
+    I64X2_SHR_S = 0xCC,
+    I64X2_SHR_U = 0xCD,
+    I64X2_ADD = 0xCE,
+    I64X2_SUB = 0xD1,
+    I64X2_MUL = 0xD5,
+    I64X2_EQ = 0xD6,
+    I64X2_NE = 0xD7,
+    I64X2_LT_S = 0xD8,
+    I64X2_GT_S = 0xD9,
+    I64X2_LE_S = 0xDA,
+    I64X2_GE_S = 0xDB,
+    I64X2_EXTMUL_LOW_I32X4_S = 0xDC,
+    I64X2_EXTMUL_HIGH_I32X4_S = 0xDD,
+    I64X2_EXTMUL_LOW_I32X4_U = 0xDE,
+    I64X2_EXTMUL_HIGH_I32X4_U = 0xDF,
+    F32X4_ABS = 0xE0,
+    F32X4_NEG = 0xE1,
+    F32X4_SQRT = 0xE3,
+    F32X4_ADD = 0xE4,
+    F32X4_SUB = 0xE5,
+    F32X4_MUL = 0xE6,
+    F32X4_DIV = 0xE7,
+    F32X4_MIN = 0xE8,
+    F32X4_MAX = 0xE9,
+    F32X4_PMIN = 0xEA,
+    F32X4_PMAX = 0xEB,
+    F64X2_ABS = 0xEC,
+    F64X2_NEG = 0xED,
+    F64X2_SQRT = 0xEF,
+    F64X2_ADD = 0xF0,
+    F64X2_SUB = 0xF1,
+    F64X2_MUL = 0xF2,
+    F64X2_DIV = 0xF3,
+    F64X2_MIN = 0xF4,
+    F64X2_MAX = 0xF5,
+    F64X2_PMIN = 0xF6,
+    F64X2_PMAX = 0xF7,
+    I32X4_TRUNC_SAT_F32X4_S = 0xF8,
+    I32X4_TRUNC_SAT_F32X4_U = 0xF9,
+    F32X4_CONVERT_I32X4_S = 0xFA,
+    F32X4_CONVERT_I32X4_U = 0xFB,
+    I32X4_TRUNC_SAT_F64X2_S_ZERO = 0xFC,
+    I32X4_TRUNC_SAT_F64X2_U_ZERO = 0xFD,
+    F64X2_CONVERT_LOW_I32X4_S = 0xFE,
+    F64X2_CONVERT_LOW_I32X4_U = 0xFF,
+  };
+  Type type;
+  // Lane index of extract_lane, replace_lane, load*_lane and store*_lane.
+  Byte lane;
+  // Memory argument of loads and stores.
+  BasicMemoryInstruction::MemoryArgument arg;
+
+  static constexpr bool hasMemoryArgument(uint32_t op) {
+    return op <= 0x0B || (0x54 <= op && op <= 0x5D);
+  }
+  static constexpr bool hasLane(uint32_t op) {
+    return (0x15 <= op && op <= 0x22) || (0x54 <= op && op <= 0x5B);
+  }
+
+  bool operator==(const SimdInstruction& o) const {
+    return type == o.type && lane == o.lane && arg == o.arg;
+  }
+  bool operator!=(const SimdInstruction& o) const { return !(*this == o); }
+};
+
+// v128.const
+struct SimdConstInstruction {
+  V128 value;
+
+  bool operator==(const SimdConstInstruction& o) const {
+    return value == o.value;
+  }
+  bool operator!=(const SimdConstInstruction& o) const {
+    return !(*this == o);
+  }
+};
+
+// i8x16.shuffle
+struct SimdShuffleInstruction {
+  std::array<Byte, 16> lanes;
+
+  bool operator==(const SimdShuffleInstruction& o) const {
+    return lanes == o.lanes;
+  }
+  bool operator!=(const SimdShuffleInstruction& o) const {
+    return !(*this == o);
+  }
+};
+
+#ifdef WASMPARSER_CPP_COUNT_COPIES
+// Counts the copies of instructions, nested ones included, so that tests can
+// check that they are moved instead. Define WASMPARSER_CPP_COUNT_COPIES for
+// every translation unit of the program or for none.
+struct InstructionCopyCounter {
+  static inline size_t copies = 0;
+
+  InstructionCopyCounter() = default;
+  InstructionCopyCounter(const InstructionCopyCounter&) noexcept { ++copies; }
+  InstructionCopyCounter(InstructionCopyCounter&&) noexcept = default;
+  InstructionCopyCounter& operator=(const InstructionCopyCounter&) noexcept {
+    ++copies;
+    return *this;
+  }
+  InstructionCopyCounter& operator=(InstructionCopyCounter&&) noexcept =
+      default;
+};
+#endif
+
 struct Instruction {
   InstructionType type;
   BlockInstruction block_instruction;
@@ -325,8 +843,103 @@ struct Instruction {
     MemorySizeInstruction memory_size_instruction;
     NumericConstInstruction numeric_const_instruction;
     NumericInstruction numeric_instruction;
+    SimdInstruction simd_instruction;
+    SimdConstInstruction simd_const_instruction;
+    SimdShuffleInstruction simd_shuffle_instruction;
+    SaturatingTruncationInstruction saturating_truncation_instruction;
+    BulkMemoryInstruction bulk_memory_instruction;
+    AtomicInstruction atomic_instruction;
   };
+#ifdef WASMPARSER_CPP_COUNT_COPIES
+  InstructionCopyCounter copy_counter;
+#endif
+
+  bool operator==(const Instruction& o) const;
+  bool operator!=(const Instruction& o) const { return !(*this == o); }
 };
+
+// Otherwise growing a std::vector<Instruction> deep-copies every nested
+// block instead of moving it.
+static_assert(std::is_nothrow_move_constructible_v<Instruction>);
+
+// Defined inline because this header is also included by translation units
+// generated by wasmparser_aotgen, which are linked next to the parser.
+inline bool BlockInstruction::operator==(const BlockInstruction& o) const {
+  if (type != o.type || block_type != o.block_type) {
+    return false;
+  }
+  if (block_type == BlockType::ValueType && value_type != o.value_type) {
+    return false;
+  }
+  if (block_type == BlockType::TypeIndex && type_idx != o.type_idx) {
+    return false;
+  }
+  return instructions == o.instructions &&
+         else_instructions == o.else_instructions;
+}
+
+inline bool NumericConstInstruction::operator==(
+    const NumericConstInstruction& o) const {
+  if (type != o.type) {
+    return false;
+  }
+  // Floats are compared by bit pattern so that NaN payloads are kept apart
+  // and a NaN constant equals itself.
+  switch (type) {
+    case Type::I32_CONST:
+    case Type::F32_CONST:
+      return std::memcmp(&i32_value, &o.i32_value, sizeof(int32_t)) == 0;
+    case Type::I64_CONST:
+    case Type::F64_CONST:
+      return std::memcmp(&i64_value, &o.i64_value, sizeof(int64_t)) == 0;
+  }
+  return false;
+}
+
+inline bool Instruction::operator==(const Instruction& o) const {
+  if (type != o.type) {
+    return false;
+  }
+  switch (type) {
+    case InstructionType::SingleOperandControl:
+      return single_operand_control_instruction ==
+             o.single_operand_control_instruction;
+    case InstructionType::Block:
+      return block_instruction == o.block_instruction;
+    case InstructionType::Branch:
+      return branch_instruction == o.branch_instruction;
+    case InstructionType::TableBranch:
+      return table_branch_instruction == o.table_branch_instruction;
+    case InstructionType::Call:
+      return call_instruction == o.call_instruction;
+    case InstructionType::Parametric:
+      return parametric_instruction == o.parametric_instruction;
+    case InstructionType::Variable:
+      return variable_instruction == o.variable_instruction;
+    case InstructionType::BasicMemory:
+      return basic_memory_instruction == o.basic_memory_instruction;
+    case InstructionType::MemorySize:
+      return memory_size_instruction == o.memory_size_instruction;
+    case InstructionType::Numeric:
+      return numeric_instruction == o.numeric_instruction;
+    case InstructionType::NumericConst:
+      return numeric_const_instruction == o.numeric_const_instruction;
+    case InstructionType::Simd:
+      return simd_instruction == o.simd_instruction;
+    case InstructionType::SimdConst:
+      return simd_const_instruction == o.simd_const_instruction;
+    case InstructionType::SimdShuffle:
+      return simd_shuffle_instruction == o.simd_shuffle_instruction;
+    case InstructionType::SaturatingTruncation:
+      return saturating_truncation_instruction ==
+             o.saturating_truncation_instruction;
+    case InstructionType::BulkMemory:
+      return bulk_memory_instruction == o.bulk_memory_instruction;
+    case InstructionType::Atomic:
+      return atomic_instruction == o.atomic_instruction;
+  }
+  return false;
+}
 }  // namespace wasmparser
 
 #endif  // WASMPARSER_CPP_INSTRUCTIONS_H
@@ -31,15 +31,33 @@
 
 namespace wasmparser {
 
-size_t decodeULEB128(Byte *buf, uint32_t *r) {
+// The decoders are constexpr so that modules embedded at compile time can be
+// parsed in constant expressions, see static_parser.h. Results are assembled
+// in unsigned integers because shifting into or out of the sign bit of a
+// signed integer is undefined.
+//
+// They read at most `avail` bytes from `buf`, and no more than the longest
+// encoding of their type takes, and return the length of the value, or 0
+// when it doesn't end within those bytes.
+
+// Longest encodings of 32-bit and 64-bit values.
+constexpr size_t MAX_LEB128_32_LENGTH = 5;
+constexpr size_t MAX_LEB128_LENGTH = 10;
+
+constexpr size_t decodeULEB128(const Byte *buf, size_t avail, uint32_t *r) {
   uint32_t result = 0;
   int shift = 0;
-  Byte byte;
-  int i = 0;
+  Byte byte = 0;
+  size_t i = 0;
 
   while (true) {
+    if (i == avail || i == MAX_LEB128_32_LENGTH) {
+      return 0;
+    }
     byte = buf[i];
-    result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (shift < 32) {
+      result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    }
     shift += 7;
     ++i;
     if ((byte & 0x80) == 0) {
@@ -50,15 +68,20 @@ size_t decodeULEB128(Byte *buf, uint32_t *r) {
   return i;
 }
 
-size_t decodeULEB128(Byte *buf, uint64_t *r) {
+constexpr size_t decodeULEB128(const Byte *buf, size_t avail, uint64_t *r) {
   uint64_t result = 0;
   int shift = 0;
-  Byte byte;
-  int i = 0;
+  Byte byte = 0;
+  size_t i = 0;
 
   while (true) {
+    if (i == avail || i == MAX_LEB128_LENGTH) {
+      return 0;
+    }
     byte = buf[i];
-    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (shift < 64) {
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    }
     shift += 7;
     ++i;
     if ((byte & 0x80) == 0) {
@@ -69,15 +92,20 @@ size_t decodeULEB128(Byte *buf, uint64_t *r) {
   return i;
 }
 
-size_t decodeSLEB128(Byte *buf, int32_t *r) {
-  int32_t result = 0;
+constexpr size_t decodeSLEB128(const Byte *buf, size_t avail, int32_t *r) {
+  uint32_t result = 0;
   int shift = 0;
-  Byte byte;
-  int i = 0;
+  Byte byte = 0;
+  size_t i = 0;
 
   while (true) {
+    if (i == avail || i == MAX_LEB128_32_LENGTH) {
+      return 0;
+    }
     byte = buf[i];
-    result |= static_cast<int32_t>(byte & 0x7f) << shift;
+    if (shift < 32) {
+      result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    }
     shift += 7;
     ++i;
     if ((byte & 0x80) == 0) {
@@ -86,22 +114,27 @@ size_t decodeSLEB128(Byte *buf, int32_t *r) {
   }
 
   if (shift < 32 && (byte & 0x40) != 0) {
-    result |= static_cast<int32_t>(~0 << shift);
+    result |= ~static_cast<uint32_t>(0) << shift;
   }
 
-  *r = result;
+  *r = static_cast<int32_t>(result);
   return i;
 }
 
-size_t decodeSLEB128(Byte *buf, int64_t *r) {
-  int64_t result = 0;
+constexpr size_t decodeSLEB128(const Byte *buf, size_t avail, int64_t *r) {
+  uint64_t result = 0;
   int shift = 0;
-  Byte byte;
-  int i = 0;
+  Byte byte = 0;
+  size_t i = 0;
 
   while (true) {
+    if (i == avail || i == MAX_LEB128_LENGTH) {
+      return 0;
+    }
     byte = buf[i];
-    result |= static_cast<int64_t>(byte & 0x7f) << shift;
+    if (shift < 64) {
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    }
     shift += 7;
     ++i;
     if ((byte & 0x80) == 0) {
@@ -110,36 +143,52 @@ size_t decodeSLEB128(Byte *buf, int64_t *r) {
   }
 
   if (shift < 64 && (byte & 0x40) != 0) {
-    result |= static_cast<int64_t>(~0 << shift);
+    result |= ~static_cast<uint64_t>(0) << shift;
   }
 
-  *r = result;
+  *r = static_cast<int64_t>(result);
   return i;
 }
 
-// TODO: Correct?
-size_t decodeS33LEB128(Byte *buf, int64_t *r) {
-  int64_t result = 0;
-  int shift = 0;
-  Byte byte;
-  int i = 0;
+// s33 values fit in int64_t, so they share the signed 64-bit decoder, but
+// take at most five bytes.
+constexpr size_t decodeS33LEB128(const Byte *buf, size_t avail, int64_t *r) {
+  return decodeSLEB128(
+      buf, avail < MAX_LEB128_32_LENGTH ? avail : MAX_LEB128_32_LENGTH, r);
+}
 
-  while (true) {
-    byte = buf[i];
-    result |= static_cast<int64_t>(byte & 0x7f) << shift;
-    shift += 7;
-    ++i;
-    if ((byte & 0x80) == 0) {
-      break;
+// The encoders write the shortest encoding of `v` to `buf`, which must have
+// room for MAX_LEB128_LENGTH bytes, and return its length.
+
+constexpr size_t encodeULEB128(uint64_t v, Byte *buf) {
+  size_t i = 0;
+  do {
+    Byte byte = v & 0x7f;
+    v >>= 7;
+    if (v != 0) {
+      byte |= 0x80;
     }
-  }
+    buf[i++] = byte;
+  } while (v != 0);
+  return i;
+}
 
-  if (shift < 64 && (byte & 0x40) != 0) {
-    result |= static_cast<int64_t>(~0 << shift);
+constexpr size_t encodeSLEB128(int64_t v, Byte *buf) {
+  size_t i = 0;
+  while (true) {
+    Byte byte = v & 0x7f;
+    // Arithmetic shift, so negative values converge to -1.
+    v = v < 0 ? ~(~v >> 7) : v >> 7;
+    bool done = (v == 0 && (byte & 0x40) == 0) ||
+                (v == -1 && (byte & 0x40) != 0);
+    if (!done) {
+      byte |= 0x80;
+    }
+    buf[i++] = byte;
+    if (done) {
+      return i;
+    }
   }
-
-  *r = result;
-  return i;
 }
 
 }  // namespace wasmparser
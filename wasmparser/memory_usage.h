@@ -0,0 +1,178 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_MEMORY_USAGE_H
+#define WASMPARSER_CPP_MEMORY_USAGE_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "instructions.h"
+#include "small_vector.h"
+
+namespace wasmparser {
+
+// Heap bytes owned by a part of a module. `size` counts the bytes holding
+// elements, `capacity` the bytes allocated for them, so the difference is
+// slack left by vector growth.
+struct MemoryUsage {
+  size_t size{0};
+  size_t capacity{0};
+
+  MemoryUsage& operator+=(const MemoryUsage& o) {
+    size += o.size;
+    capacity += o.capacity;
+    return *this;
+  }
+};
+
+// Parsed sections of a Module. Names of imports, exports and custom sections
+// are accounted for in `names` rather than in their section.
+struct ModuleMemoryUsage {
+  MemoryUsage types;
+  MemoryUsage imports;
+  MemoryUsage functions;
+  MemoryUsage tables;
+  MemoryUsage memories;
+  MemoryUsage exports;
+  MemoryUsage customs;
+  MemoryUsage names;
+  MemoryUsage index_spaces;
+  // Undecoded section payloads, see InstructionDecoder.
+  MemoryUsage raw_globals;
+  MemoryUsage raw_elements;
+  MemoryUsage raw_code;
+  MemoryUsage raw_data;
+
+  MemoryUsage rawBuffers() const;
+  MemoryUsage total() const;
+};
+
+// Sections decoded by an InstructionDecoder.
+struct DecoderMemoryUsage {
+  MemoryUsage globals;
+  MemoryUsage elements;
+  MemoryUsage data;
+  // Code entries themselves, without their bodies.
+  MemoryUsage code;
+  // One entry per code entry: the decoded body with its locals and all
+  // nested instruction vectors. Bodies shared with other decoders through a
+  // FuncStore or incremental decoding are reported by every owner.
+  std::vector<MemoryUsage> funcs;
+  MemoryUsage code_offsets;
+  // Body hashes and lookup tables of incremental decoding. Hash table nodes
+  // and buckets are estimated, as their layout is implementation defined.
+  MemoryUsage incremental;
+
+  MemoryUsage funcsTotal() const;
+  MemoryUsage total() const;
+};
+
+template <class T>
+MemoryUsage vectorMemoryUsage(const std::vector<T>& v) {
+  return {v.size() * sizeof(T), v.capacity() * sizeof(T)};
+}
+
+// Elements stored inline belong to the owner of the vector.
+template <class T, uint32_t N>
+MemoryUsage vectorMemoryUsage(const SmallVector<T, N>& v) {
+  if (v.isInline()) {
+    return {};
+  }
+  return {v.size() * sizeof(T), v.capacity() * sizeof(T)};
+}
+
+template <class K, class V>
+MemoryUsage hashMapMemoryUsage(const std::unordered_map<K, V>& m) {
+  // A node holds the value and the link to the next node.
+  size_t node = sizeof(typename std::unordered_map<K, V>::value_type) +
+                sizeof(void*);
+  size_t buckets = m.bucket_count() * sizeof(void*);
+  return {m.size() * node + buckets, m.size() * node + buckets};
+}
+
+// Instruction vector including the vectors nested in its block and
+// br_table instructions.
+MemoryUsage instructionsMemoryUsage(const std::vector<Instruction>& instrs);
+
+MemoryUsage ModuleMemoryUsage::rawBuffers() const {
+  MemoryUsage u;
+  u += raw_globals;
+  u += raw_elements;
+  u += raw_code;
+  u += raw_data;
+  return u;
+}
+
+MemoryUsage ModuleMemoryUsage::total() const {
+  MemoryUsage u = rawBuffers();
+  u += types;
+  u += imports;
+  u += functions;
+  u += tables;
+  u += memories;
+  u += exports;
+  u += customs;
+  u += names;
+  u += index_spaces;
+  return u;
+}
+
+MemoryUsage DecoderMemoryUsage::funcsTotal() const {
+  MemoryUsage u;
+  for (const auto& f : funcs) {
+    u += f;
+  }
+  return u;
+}
+
+MemoryUsage DecoderMemoryUsage::total() const {
+  MemoryUsage u = funcsTotal();
+  u += globals;
+  u += elements;
+  u += data;
+  u += code;
+  u += code_offsets;
+  u += incremental;
+  return u;
+}
+
+MemoryUsage instructionsMemoryUsage(const std::vector<Instruction>& instrs) {
+  MemoryUsage u = vectorMemoryUsage(instrs);
+  for (const auto& i : instrs) {
+    // Block and br_table operands live outside the union, so every
+    // instruction carries these vectors, although they are empty unless the
+    // instruction is of that type.
+    u += instructionsMemoryUsage(i.block_instruction.instructions);
+    u += instructionsMemoryUsage(i.block_instruction.else_instructions);
+    u += vectorMemoryUsage(i.table_branch_instruction.l);
+  }
+  return u;
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_MEMORY_USAGE_H
@@ -26,9 +26,15 @@
 #ifndef WASMPARSER_CPP_MODULE_H
 #define WASMPARSER_CPP_MODULE_H
 
+#include <limits>
+#include <memory>
+#include <type_traits>
 #include <variant>
 
+#include "hash.h"
 #include "instructions.h"
+#include "memory_usage.h"
+#include "type_registry.h"
 #include "types.h"
 
 namespace wasmparser {
@@ -46,17 +52,25 @@ enum class SectionId : Byte {
   Element = 0x09,
   Code = 0x0a,
   Data = 0x0b,
+  DataCount = 0x0c,
 };
 
 struct Custom {
   Name name;
   std::vector<Byte> bytes;
+
+  bool operator==(const Custom& o) const {
+    return name == o.name && bytes == o.bytes;
+  }
+  bool operator!=(const Custom& o) const { return !(*this == o); }
 };
 
 struct Import {
   template <class T>
   struct ImportDesc {
     T value;
+
+    bool operator==(const ImportDesc& o) const { return value == o.value; }
   };
   using TypeIdxImportDesc = ImportDesc<uint32_t>;
   using TableTypeImportDesc = ImportDesc<TableType>;
@@ -69,6 +83,11 @@ struct Import {
   Name module_name;
   Name name;
   ImportDescVariant desc;
+
+  bool operator==(const Import& o) const {
+    return module_name == o.module_name && name == o.name && desc == o.desc;
+  }
+  bool operator!=(const Import& o) const { return !(*this == o); }
 };
 
 struct Export {
@@ -81,47 +100,159 @@ struct Export {
     };
     ExportDescType type;
     uint32_t idx;
+
+    bool operator==(const ExportDesc& o) const {
+      return type == o.type && idx == o.idx;
+    }
   };
   Name name;
   ExportDesc desc;
+
+  bool operator==(const Export& o) const {
+    return name == o.name && desc == o.desc;
+  }
+  bool operator!=(const Export& o) const { return !(*this == o); }
 };
 
 struct Func {
   struct Local {
     uint32_t n;
     ValueType t;
+
+    bool operator==(const Local& o) const { return n == o.n && t == o.t; }
+  };
+
+  // Frame of a call, computed while decoding, so that an executor can
+  // allocate the locals and the operand stack of a call at once.
+  struct Frame {
+    // Consecutive locals of the same type, params first.
+    struct Slot {
+      ValueType t;
+      // Index of the first local of the slot.
+      uint32_t first;
+      uint32_t n;
+      // Byte offset of the first local in the locals area. Every local is
+      // aligned to its own size.
+      uint64_t offset;
+
+      bool operator==(const Slot& o) const {
+        return t == o.t && first == o.first && n == o.n && offset == o.offset;
+      }
+    };
+
+    // Maximum number of values on the operand stack, block params included.
+    uint32_t max_stack_height = 0;
+    // Number of params and locals.
+    uint32_t local_count = 0;
+    std::vector<Slot> slots;
+    // Byte size of the locals area.
+    uint64_t locals_size = 0;
+
+    bool operator==(const Frame& o) const {
+      return max_stack_height == o.max_stack_height &&
+             local_count == o.local_count && slots == o.slots &&
+             locals_size == o.locals_size;
+    }
+    bool operator!=(const Frame& o) const { return !(*this == o); }
   };
 
-  std::vector<Local> locals;
+  // Bodies usually declare a few runs of locals, which are kept inline.
+  SmallVector<Local, 4> locals;
   std::vector<Instruction> expr;
+  Frame frame;
+
+  bool operator==(const Func& o) const {
+    return locals == o.locals && expr == o.expr && frame == o.frame;
+  }
+  bool operator!=(const Func& o) const { return !(*this == o); }
 };
 
 struct Code {
   uint32_t size;
-  Func code;
+  // Decoded bodies are immutable once built, so that identical bodies can be
+  // shared between versions of a module and between modules.
+  std::shared_ptr<const Func> code;
+
+  bool operator==(const Code& o) const {
+    if (size != o.size) {
+      return false;
+    }
+    if (code == o.code) {
+      return true;
+    }
+    return code != nullptr && o.code != nullptr && *code == *o.code;
+  }
+  bool operator!=(const Code& o) const { return !(*this == o); }
 };
 
 struct Global {
   GlobalType type;
   std::vector<Instruction> init;
+
+  bool operator==(const Global& o) const {
+    return type == o.type && init == o.init;
+  }
+  bool operator!=(const Global& o) const { return !(*this == o); }
 };
 
 struct ElementSegment {
-  uint32_t table;
+  enum class Mode : Byte {
+    Active,
+    Passive,
+    Declarative,
+  };
+  Mode mode = Mode::Active;
+  // Only funcref (0x00) is defined.
+  Byte elem_kind = 0x00;
+  // Table and offset of active segments.
+  uint32_t table = 0;
   std::vector<Instruction> offset;
   std::vector<uint32_t> init;
+
+  bool operator==(const ElementSegment& o) const {
+    return mode == o.mode && elem_kind == o.elem_kind && table == o.table &&
+           offset == o.offset && init == o.init;
+  }
+  bool operator!=(const ElementSegment& o) const { return !(*this == o); }
 };
 
 struct DataSegment {
-  uint32_t data;
+  enum class Mode : Byte {
+    Active,
+    Passive,
+  };
+  Mode mode = Mode::Active;
+  // Memory and offset of active segments.
+  uint32_t data = 0;
   std::vector<Instruction> offset;
   std::vector<Byte> init;
+
+  bool operator==(const DataSegment& o) const {
+    return mode == o.mode && data == o.data && offset == o.offset &&
+           init == o.init;
+  }
+  bool operator!=(const DataSegment& o) const { return !(*this == o); }
 };
 
 template <class T>
 struct Section {
-  uint32_t size;
-  T value;
+  uint32_t size{0};
+  T value{};
+
+  // Empties the section, keeping the storage of its value.
+  void clear() {
+    size = 0;
+    if constexpr (std::is_integral_v<T>) {
+      value = 0;
+    } else {
+      value.clear();
+    }
+  }
+
+  bool operator==(const Section& o) const {
+    return size == o.size && value == o.value;
+  }
+  bool operator!=(const Section& o) const { return !(*this == o); }
 };
 
 using TypeSection = Section<std::vector<FuncType>>;
@@ -131,21 +262,76 @@ using TableSection = Section<std::vector<TableType>>;
 using MemorySection = Section<std::vector<MemoryType>>;
 using ExportSection = Section<std::vector<Export>>;
 using StartSection = Section<uint32_t>;
+using DataCountSection = Section<uint32_t>;
 using CustomSection = Section<Custom>;
 
+// Moves the storage of `from`, a vector of an entry of a previous module,
+// into `to` and empties it, so that the entry of the next module is parsed
+// or decoded into it without allocating.
+template <class V>
+void reuseStorage(V* from, V* to) {
+  *to = std::move(*from);
+  to->clear();
+}
+
+// Empties `entries`, keeping the entries in `spares` for the entries of the
+// next module to take their storage over with reuseStorage. An empty
+// `entries` leaves the spares alone, so that clearing twice keeps them.
+template <class V>
+void keepSpares(V* entries, V* spares) {
+  if (!entries->empty()) {
+    spares->swap(*entries);
+    entries->clear();
+  }
+}
+
 // These sections have the value which can't be distinguished on runtime.
 // In detail, we can't determine the length of internal structures because it
 // has expressions.
-using RawBufferDataSection = Section<Bytes>;
-using RawBufferCodeSection = Section<Bytes>;
-using RawBufferElementSection = Section<Bytes>;
-using RawBufferGlobalSection = Section<Bytes>;
+struct RawBufferSection : Section<Bytes> {
+  // Module byte offset of value[0], used to map decoded entities back to the
+  // original binary.
+  size_t offset{0};
+  // Entry count of the vector in value, so that the decoder can preallocate.
+  // Not compared, as it is implied by value.
+  uint32_t count{0};
+
+  void clear() {
+    Section::clear();
+    offset = 0;
+    count = 0;
+  }
+};
+
+using RawBufferDataSection = RawBufferSection;
+using RawBufferCodeSection = RawBufferSection;
+using RawBufferElementSection = RawBufferSection;
+using RawBufferGlobalSection = RawBufferSection;
 
 using CodeSection = std::vector<Code>;
 using DataSection = std::vector<DataSegment>;
 using ElementSection = std::vector<ElementSegment>;
 using GlobalSection = std::vector<Global>;
 
+// Entities of one kind in index order: the imported ones followed by the
+// defined ones.
+template <class T>
+struct IndexSpace {
+  std::vector<T> entries;
+  uint32_t imported{0};
+
+  uint32_t size() const { return static_cast<uint32_t>(entries.size()); }
+  bool isImported(uint32_t idx) const { return idx < imported; }
+  const T& operator[](uint32_t idx) const { return entries[idx]; }
+
+  // Drops the defined entities.
+  void resetDefined() { entries.resize(imported); }
+  void clear() {
+    entries.clear();
+    imported = 0;
+  }
+};
+
 struct Module {
  public:
   TypeSection type_sec;
@@ -159,9 +345,263 @@ struct Module {
   RawBufferElementSection element_sec;
   RawBufferCodeSection code_sec;
   RawBufferDataSection data_sec;
+  DataCountSection data_count_sec;
   std::vector<CustomSection> custom_sec;
+  // Ids of the parsed sections in file order, custom sections included, so
+  // that ModuleWriter can put custom sections back where they were. Layout
+  // only, so not compared or hashed.
+  std::vector<SectionId> section_order;
+
+  // Index spaces, built by the parser from the import section and the
+  // defined sections, so that resolving an index is a single array access.
+  // Derived, so not compared or hashed.
+  //
+  // Type index per function.
+  IndexSpace<uint32_t> func_space;
+  IndexSpace<TableType> table_space;
+  IndexSpace<MemoryType> memory_space;
+  // Defined globals are only known once their section is decoded, so they
+  // are added by InstructionDecoder.
+  IndexSpace<GlobalType> global_space;
+  // Canonical id per type index, see TypeRegistry. The parser assigns ids
+  // local to the module; canonicalizeTypes moves them to a shared registry.
+  std::vector<uint32_t> canonical_types;
+  // Registry of canonical_types, nullptr for module-local ids. Ids are only
+  // comparable between modules of the same registry.
+  TypeRegistry* type_registry{nullptr};
+
+  // Modules are move-only, as copying one deep-copies every section.
+  // InstructionDecoder keeps a pointer to its module, so a module must not
+  // be moved while a decoder of it is in use.
+  Module() = default;
+  Module(const Module&) = delete;
+  Module& operator=(const Module&) = delete;
+  Module(Module&&) = default;
+  Module& operator=(Module&&) = default;
+
+  bool operator==(const Module& o) const {
+    return type_sec == o.type_sec && import_sec == o.import_sec &&
+           func_sec == o.func_sec && table_sec == o.table_sec &&
+           mem_sec == o.mem_sec && global_sec == o.global_sec &&
+           export_sec == o.export_sec && start_sec == o.start_sec &&
+           element_sec == o.element_sec && code_sec == o.code_sec &&
+           data_sec == o.data_sec && data_count_sec == o.data_count_sec &&
+           custom_sec == o.custom_sec;
+  }
+  bool operator!=(const Module& o) const { return !(*this == o); }
+
+  // Heap bytes owned by the module, by section.
+  ModuleMemoryUsage memoryUsage() const;
+
+  // Empties the module, keeping the storage of its vectors, so that the
+  // next module can be parsed into it with fewer allocations.
+  void clear();
+
+  // Rebuilds the index spaces from the sections. Defined globals are
+  // dropped. Canonical type ids are assigned within the module.
+  void buildIndexSpaces();
+  // Assigns canonical type ids of `registry`, or module-local ones if it is
+  // nullptr.
+  void canonicalizeTypes(TypeRegistry* registry);
+  // Canonical type id of a function, so that a call_indirect check or an
+  // import match compares two integers.
+  uint32_t funcCanonicalType(uint32_t func_idx) const {
+    return canonical_types[func_space[func_idx]];
+  }
 };
 
+void Module::clear() {
+  type_sec.clear();
+  import_sec.clear();
+  func_sec.clear();
+  table_sec.clear();
+  mem_sec.clear();
+  global_sec.clear();
+  export_sec.clear();
+  start_sec.clear();
+  element_sec.clear();
+  code_sec.clear();
+  data_sec.clear();
+  data_count_sec.clear();
+  custom_sec.clear();
+  section_order.clear();
+  func_space.clear();
+  table_space.clear();
+  memory_space.clear();
+  global_space.clear();
+  canonical_types.clear();
+  type_registry = nullptr;
+}
+
+void Module::buildIndexSpaces() {
+  func_space.clear();
+  table_space.clear();
+  memory_space.clear();
+  global_space.clear();
+  for (const auto& ip : import_sec.value) {
+    if (auto* ti = std::get_if<Import::TypeIdxImportDesc>(&ip.desc)) {
+      func_space.entries.emplace_back(ti->value);
+    } else if (auto* tt = std::get_if<Import::TableTypeImportDesc>(&ip.desc)) {
+      table_space.entries.emplace_back(tt->value);
+    } else if (auto* mt = std::get_if<Import::MemTypeImportDesc>(&ip.desc)) {
+      memory_space.entries.emplace_back(mt->value);
+    } else if (auto* gt = std::get_if<Import::GlobalTypeImportDesc>(&ip.desc)) {
+      global_space.entries.emplace_back(gt->value);
+    }
+  }
+  func_space.imported = func_space.size();
+  table_space.imported = table_space.size();
+  memory_space.imported = memory_space.size();
+  global_space.imported = global_space.size();
+  func_space.entries.insert(func_space.entries.end(), func_sec.value.begin(),
+                            func_sec.value.end());
+  table_space.entries.insert(table_space.entries.end(),
+                             table_sec.value.begin(), table_sec.value.end());
+  memory_space.entries.insert(memory_space.entries.end(),
+                              mem_sec.value.begin(), mem_sec.value.end());
+  canonicalizeTypes(nullptr);
+}
+
+void Module::canonicalizeTypes(TypeRegistry* registry) {
+  const auto& types = type_sec.value;
+  canonical_types.clear();
+  canonical_types.reserve(types.size());
+  type_registry = registry;
+  if (registry != nullptr) {
+    for (const auto& ft : types) {
+      canonical_types.emplace_back(registry->intern(ft));
+    }
+    return;
+  }
+  // Module-local ids are numbered in order of first occurrence, as by a
+  // fresh registry, but through an open addressing table of type indices
+  // which each thread keeps for its storage.
+  constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+  thread_local std::vector<uint32_t> table;
+  size_t slots = 1;
+  while (slots < types.size() * 2) {
+    slots *= 2;
+  }
+  table.assign(slots, EMPTY);
+  uint32_t next_id = 0;
+  for (uint32_t i = 0; i < types.size(); ++i) {
+    size_t slot = TypeRegistry::hashType(types[i]) & (slots - 1);
+    while (table[slot] != EMPTY && !(types[table[slot]] == types[i])) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    if (table[slot] == EMPTY) {
+      table[slot] = i;
+      canonical_types.emplace_back(next_id++);
+    } else {
+      canonical_types.emplace_back(canonical_types[table[slot]]);
+    }
+  }
+}
+
+ModuleMemoryUsage Module::memoryUsage() const {
+  ModuleMemoryUsage u;
+  u.types = vectorMemoryUsage(type_sec.value);
+  u.types += vectorMemoryUsage(canonical_types);
+  for (const auto& ft : type_sec.value) {
+    u.types += vectorMemoryUsage(ft.param_type);
+    u.types += vectorMemoryUsage(ft.return_type);
+  }
+  u.imports = vectorMemoryUsage(import_sec.value);
+  for (const auto& ip : import_sec.value) {
+    u.names += vectorMemoryUsage(ip.module_name);
+    u.names += vectorMemoryUsage(ip.name);
+  }
+  u.functions = vectorMemoryUsage(func_sec.value);
+  u.tables = vectorMemoryUsage(table_sec.value);
+  u.memories = vectorMemoryUsage(mem_sec.value);
+  u.exports = vectorMemoryUsage(export_sec.value);
+  for (const auto& e : export_sec.value) {
+    u.names += vectorMemoryUsage(e.name);
+  }
+  u.customs = vectorMemoryUsage(custom_sec);
+  for (const auto& cs : custom_sec) {
+    u.customs += vectorMemoryUsage(cs.value.bytes);
+    u.names += vectorMemoryUsage(cs.value.name);
+  }
+  u.customs += vectorMemoryUsage(section_order);
+  u.index_spaces = vectorMemoryUsage(func_space.entries);
+  u.index_spaces += vectorMemoryUsage(table_space.entries);
+  u.index_spaces += vectorMemoryUsage(memory_space.entries);
+  u.index_spaces += vectorMemoryUsage(global_space.entries);
+  u.raw_globals = vectorMemoryUsage(global_sec.value);
+  u.raw_elements = vectorMemoryUsage(element_sec.value);
+  u.raw_code = vectorMemoryUsage(code_sec.value);
+  u.raw_data = vectorMemoryUsage(data_sec.value);
+  return u;
+}
+
+// Content hash consistent with Module::operator==. Raw buffer sections are
+// hashed as bytes, which keeps hashing far cheaper than decoding.
+uint64_t hashModule(const Module& m) {
+  uint64_t h = HASH_SEED;
+  auto hashName = [&h](const Name& n) {
+    h = combineHash(h, hashBytes(n.data(), n.size()));
+  };
+  auto hashLimit = [&h](const Limit& l) {
+    h = combineHash(h, l.min_);
+    h = combineHash(h, l.max_.has_value() ? *l.max_ + 1ull : 0);
+    h = combineHash(h, l.shared);
+    h = combineHash(h, l.is64);
+  };
+  for (const auto& ft : m.type_sec.value) {
+    h = combineHash(h, hashBytes(reinterpret_cast<const Byte*>(
+                                     ft.param_type.data()),
+                                 ft.param_type.size()));
+    h = combineHash(h, hashBytes(reinterpret_cast<const Byte*>(
+                                     ft.return_type.data()),
+                                 ft.return_type.size()));
+  }
+  for (const auto& ip : m.import_sec.value) {
+    hashName(ip.module_name);
+    hashName(ip.name);
+    h = combineHash(h, ip.desc.index());
+    if (auto* ti = std::get_if<Import::TypeIdxImportDesc>(&ip.desc)) {
+      h = combineHash(h, ti->value);
+    } else if (auto* tt = std::get_if<Import::TableTypeImportDesc>(&ip.desc)) {
+      h = combineHash(h, tt->value.elem_type);
+      hashLimit(tt->value.limit);
+    } else if (auto* mt = std::get_if<Import::MemTypeImportDesc>(&ip.desc)) {
+      hashLimit(mt->value.limit);
+    } else if (auto* gt = std::get_if<Import::GlobalTypeImportDesc>(&ip.desc)) {
+      h = combineHash(h, static_cast<uint64_t>(gt->value.val_type));
+      h = combineHash(h, static_cast<uint64_t>(gt->value.mut));
+    }
+  }
+  for (auto idx : m.func_sec.value) {
+    h = combineHash(h, idx);
+  }
+  for (const auto& tt : m.table_sec.value) {
+    h = combineHash(h, tt.elem_type);
+    hashLimit(tt.limit);
+  }
+  for (const auto& mt : m.mem_sec.value) {
+    hashLimit(mt.limit);
+  }
+  for (const auto& e : m.export_sec.value) {
+    hashName(e.name);
+    h = combineHash(h, static_cast<uint64_t>(e.desc.type));
+    h = combineHash(h, e.desc.idx);
+  }
+  h = combineHash(h, m.start_sec.size);
+  h = combineHash(h, m.start_sec.value);
+  h = combineHash(h, m.data_count_sec.size);
+  h = combineHash(h, m.data_count_sec.value);
+  for (const auto* raw : {&m.global_sec, &m.element_sec, &m.code_sec,
+                          &m.data_sec}) {
+    h = combineHash(h, hashBytes(raw->value.data(), raw->value.size()));
+  }
+  for (const auto& cs : m.custom_sec) {
+    hashName(cs.value.name);
+    h = combineHash(h, hashBytes(cs.value.bytes.data(), cs.value.bytes.size()));
+  }
+  return h;
+}
+
 }  // namespace wasmparser
 
 #endif  // WASMPARSER_CPP_MODULE_H
@@ -0,0 +1,627 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_MODULE_WRITER_H
+#define WASMPARSER_CPP_MODULE_WRITER_H
+
+#include <array>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "instruction_decoder.h"
+#include "module.h"
+#include "output_buffer.h"
+#include "parser.h"
+#include "thread_pool.h"
+
+namespace wasmparser {
+
+// Encodes a module back to the binary format. Sections parsed into `m` are
+// taken from it; globals, elements, data and code are taken from their
+// decoded form in `d`, so that transformations of decoded functions are
+// written out. Integers are written in their shortest LEB128 encoding,
+// except in code entries copied as parsed, see below.
+//
+// Custom sections are put back after the same known section as in the
+// parsed file, see Module::section_order. Sections are otherwise written in
+// the order of the specification. Code entries whose body wasn't replaced
+// are copied as parsed, so padded LEB128s in bodies, e.g. relocatable
+// immediates, are kept and an unmodified module of the usual toolchains is
+// written back byte for byte. The global, element and data sections are
+// always encoded again from their decoded form, so a module with padded
+// LEB128s in them, or in any section header or known section other than
+// code, is not written back exactly. Sections of unknown id were dropped by
+// the parser.
+class ModuleWriter {
+ public:
+  ModuleWriter(const Module* m, const InstructionDecoder* d,
+               ThreadPool* pool = &ThreadPool::global())
+      : m_(m), d_(d), pool_(pool) {}
+
+  void write(OutputBuffer* out) const;
+  Bytes write() const;
+  void writeFile(std::string_view filename) const;
+
+  // Body of a code entry, without its size.
+  static void encodeFunc(const Func& f, OutputBuffer* out);
+  // Instructions followed by the end opcode.
+  static void encodeExpr(const std::vector<Instruction>& instrs,
+                         OutputBuffer* out);
+  static void encodeInstruction(const Instruction& i, OutputBuffer* out);
+
+ private:
+  // Contents of a section, gathered so that its size is known before it is
+  // written and nothing has to be moved to make room for the size. Fields
+  // are encoded into `fields`, while code bodies and other payloads are
+  // referenced where they are and copied once, by writeTo.
+  struct Section {
+    struct Range {
+      // Size of `fields` when the range was added.
+      size_t at;
+      const Byte* data;
+      size_t size;
+    };
+
+    VectorOutputBuffer fields;
+    std::vector<Range> ranges;
+
+    void addRange(const Byte* data, size_t size) {
+      ranges.push_back({fields.size(), data, size});
+    }
+    // Writes the section with id `id` and clears it for the next one.
+    void writeTo(SectionId id, OutputBuffer* out);
+  };
+
+  bool hasSection(SectionId id) const;
+  void writeSection(SectionId id, Section* section, OutputBuffer* out) const;
+  void writeCustomSection(const CustomSection& cs, Section* section,
+                          OutputBuffer* out) const;
+  void writeCodeSection(Section* section, OutputBuffer* out) const;
+  // Parsed bytes of code entry `i`, its size included, if its body is still
+  // the decoded one. Otherwise nullptr.
+  const Byte* codeSource(size_t i, size_t* size) const;
+
+  static void encodeName(const Name& name, OutputBuffer* out);
+  static void encodeLimits(const Limit& l, OutputBuffer* out);
+  static void encodeMemoryArgument(
+      const BasicMemoryInstruction::MemoryArgument& arg, OutputBuffer* out);
+
+  const Module* m_;
+  const InstructionDecoder* d_;
+  ThreadPool* pool_;
+};
+
+namespace {
+
+// Known sections in the order in which they are written.
+constexpr std::array<SectionId, 12> SECTION_ORDER = {
+    SectionId::Type,    SectionId::Import,    SectionId::Function,
+    SectionId::Table,   SectionId::Memory,    SectionId::Global,
+    SectionId::Export,  SectionId::Start,     SectionId::Element,
+    SectionId::DataCount, SectionId::Code,    SectionId::Data};
+
+}  // namespace
+
+void ModuleWriter::write(OutputBuffer* out) const {
+  out->write(MAGIC.data(), MAGIC.size());
+  out->write(VERSION.data(), VERSION.size());
+
+  // customs_after[0] holds the custom sections before any known section,
+  // customs_after[k] those following SECTION_ORDER[k - 1].
+  std::array<std::vector<size_t>, SECTION_ORDER.size() + 1> customs_after;
+  size_t anchor = 0;
+  size_t custom_idx = 0;
+  for (auto id : m_->section_order) {
+    if (id == SectionId::Custom) {
+      if (custom_idx < m_->custom_sec.size()) {
+        customs_after[anchor].emplace_back(custom_idx++);
+      }
+      continue;
+    }
+    for (size_t k = 0; k < SECTION_ORDER.size(); ++k) {
+      if (SECTION_ORDER[k] == id) {
+        anchor = k + 1;
+      }
+    }
+  }
+  // Custom sections added after parsing go last.
+  for (; custom_idx < m_->custom_sec.size(); ++custom_idx) {
+    customs_after.back().emplace_back(custom_idx);
+  }
+
+  Section section;
+  for (auto idx : customs_after[0]) {
+    writeCustomSection(m_->custom_sec[idx], &section, out);
+  }
+  for (size_t k = 0; k < SECTION_ORDER.size(); ++k) {
+    if (hasSection(SECTION_ORDER[k])) {
+      writeSection(SECTION_ORDER[k], &section, out);
+    }
+    for (auto idx : customs_after[k + 1]) {
+      writeCustomSection(m_->custom_sec[idx], &section, out);
+    }
+  }
+}
+
+void ModuleWriter::Section::writeTo(SectionId id, OutputBuffer* out) {
+  size_t size = fields.size();
+  for (const auto& r : ranges) {
+    size += r.size;
+  }
+  out->writeByte(static_cast<Byte>(id));
+  out->writeU32(size);
+  size_t at = 0;
+  for (const auto& r : ranges) {
+    out->write(fields.data() + at, r.at - at);
+    out->write(r.data, r.size);
+    at = r.at;
+  }
+  out->write(fields.data() + at, fields.size() - at);
+  fields.clear();
+  ranges.clear();
+}
+
+Bytes ModuleWriter::write() const {
+  VectorOutputBuffer out;
+  write(&out);
+  return out.release();
+}
+
+void ModuleWriter::writeFile(std::string_view filename) const {
+  MmapOutputBuffer out(filename);
+  write(&out);
+  out.close();
+}
+
+bool ModuleWriter::hasSection(SectionId id) const {
+  // Empty sections are kept when the parsed module had them.
+  switch (id) {
+    case SectionId::Type:
+      return m_->type_sec.size != 0 || !m_->type_sec.value.empty();
+    case SectionId::Import:
+      return m_->import_sec.size != 0 || !m_->import_sec.value.empty();
+    case SectionId::Function:
+      return m_->func_sec.size != 0 || !m_->func_sec.value.empty();
+    case SectionId::Table:
+      return m_->table_sec.size != 0 || !m_->table_sec.value.empty();
+    case SectionId::Memory:
+      return m_->mem_sec.size != 0 || !m_->mem_sec.value.empty();
+    case SectionId::Global:
+      return m_->global_sec.size != 0 || !d_->gs_.empty();
+    case SectionId::Export:
+      return m_->export_sec.size != 0 || !m_->export_sec.value.empty();
+    case SectionId::Start:
+      return m_->start_sec.size != 0;
+    case SectionId::Element:
+      return m_->element_sec.size != 0 || !d_->es_.empty();
+    case SectionId::DataCount:
+      return m_->data_count_sec.size != 0;
+    case SectionId::Code:
+      return m_->code_sec.size != 0 || !d_->cs_.empty();
+    case SectionId::Data:
+      return m_->data_sec.size != 0 || !d_->ds_.empty();
+    case SectionId::Custom:
+      break;
+  }
+  return false;
+}
+
+void ModuleWriter::writeSection(SectionId id, Section* section,
+                                OutputBuffer* out) const {
+  if (id == SectionId::Code) {
+    writeCodeSection(section, out);
+    return;
+  }
+  OutputBuffer* fields = &section->fields;
+  switch (id) {
+    case SectionId::Type:
+      fields->writeU32(m_->type_sec.value.size());
+      for (const auto& ft : m_->type_sec.value) {
+        fields->writeByte(0x60);
+        fields->writeU32(ft.param_type.size());
+        for (auto vt : ft.param_type) {
+          fields->writeByte(static_cast<Byte>(vt));
+        }
+        fields->writeU32(ft.return_type.size());
+        for (auto vt : ft.return_type) {
+          fields->writeByte(static_cast<Byte>(vt));
+        }
+      }
+      break;
+    case SectionId::Import:
+      fields->writeU32(m_->import_sec.value.size());
+      for (const auto& ip : m_->import_sec.value) {
+        encodeName(ip.module_name, fields);
+        encodeName(ip.name, fields);
+        fields->writeByte(static_cast<Byte>(ip.desc.index()));
+        if (auto* ti = std::get_if<Import::TypeIdxImportDesc>(&ip.desc)) {
+          fields->writeU32(ti->value);
+        } else if (auto* tt =
+                       std::get_if<Import::TableTypeImportDesc>(&ip.desc)) {
+          fields->writeByte(tt->value.elem_type);
+          encodeLimits(tt->value.limit, fields);
+        } else if (auto* mt =
+                       std::get_if<Import::MemTypeImportDesc>(&ip.desc)) {
+          encodeLimits(mt->value.limit, fields);
+        } else if (auto* gt =
+                       std::get_if<Import::GlobalTypeImportDesc>(&ip.desc)) {
+          fields->writeByte(static_cast<Byte>(gt->value.val_type));
+          fields->writeByte(static_cast<Byte>(gt->value.mut));
+        }
+      }
+      break;
+    case SectionId::Function:
+      fields->writeU32(m_->func_sec.value.size());
+      for (auto idx : m_->func_sec.value) {
+        fields->writeU32(idx);
+      }
+      break;
+    case SectionId::Table:
+      fields->writeU32(m_->table_sec.value.size());
+      for (const auto& tt : m_->table_sec.value) {
+        fields->writeByte(tt.elem_type);
+        encodeLimits(tt.limit, fields);
+      }
+      break;
+    case SectionId::Memory:
+      fields->writeU32(m_->mem_sec.value.size());
+      for (const auto& mt : m_->mem_sec.value) {
+        encodeLimits(mt.limit, fields);
+      }
+      break;
+    case SectionId::Global:
+      fields->writeU32(d_->gs_.size());
+      for (const auto& g : d_->gs_) {
+        fields->writeByte(static_cast<Byte>(g.type.val_type));
+        fields->writeByte(static_cast<Byte>(g.type.mut));
+        encodeExpr(g.init, fields);
+      }
+      break;
+    case SectionId::Export:
+      fields->writeU32(m_->export_sec.value.size());
+      for (const auto& e : m_->export_sec.value) {
+        encodeName(e.name, fields);
+        fields->writeByte(static_cast<Byte>(e.desc.type));
+        fields->writeU32(e.desc.idx);
+      }
+      break;
+    case SectionId::Start:
+      fields->writeU32(m_->start_sec.value);
+      break;
+    case SectionId::Element:
+      fields->writeU32(d_->es_.size());
+      for (const auto& eseg : d_->es_) {
+        // The shortest flags which describe the segment, see
+        // InstructionDecoder::decodeElementSection.
+        bool active = eseg.mode == ElementSegment::Mode::Active;
+        bool explicit_kind =
+            !active || eseg.table != 0 || eseg.elem_kind != 0x00;
+        if (active) {
+          fields->writeU32(explicit_kind ? 0x02 : 0x00);
+          if (explicit_kind) {
+            fields->writeU32(eseg.table);
+          }
+          encodeExpr(eseg.offset, fields);
+        } else {
+          fields->writeU32(eseg.mode == ElementSegment::Mode::Passive ? 0x01
+                                                                   : 0x03);
+        }
+        if (explicit_kind) {
+          fields->writeByte(eseg.elem_kind);
+        }
+        fields->writeU32(eseg.init.size());
+        for (auto idx : eseg.init) {
+          fields->writeU32(idx);
+        }
+      }
+      break;
+    case SectionId::DataCount:
+      fields->writeU32(d_->ds_.size());
+      break;
+    case SectionId::Data:
+      fields->writeU32(d_->ds_.size());
+      for (const auto& dseg : d_->ds_) {
+        if (dseg.mode == DataSegment::Mode::Passive) {
+          fields->writeU32(0x01);
+        } else if (dseg.data == 0) {
+          fields->writeU32(0x00);
+          encodeExpr(dseg.offset, fields);
+        } else {
+          fields->writeU32(0x02);
+          fields->writeU32(dseg.data);
+          encodeExpr(dseg.offset, fields);
+        }
+        fields->writeU32(dseg.init.size());
+        section->addRange(dseg.init.data(), dseg.init.size());
+      }
+      break;
+    case SectionId::Code:
+    case SectionId::Custom:
+      break;
+  }
+  section->writeTo(id, out);
+}
+
+void ModuleWriter::writeCustomSection(const CustomSection& cs,
+                                      Section* section,
+                                      OutputBuffer* out) const {
+  encodeName(cs.value.name, &section->fields);
+  section->addRange(cs.value.bytes.data(), cs.value.bytes.size());
+  section->writeTo(SectionId::Custom, out);
+}
+
+const Byte* ModuleWriter::codeSource(size_t i, size_t* size) const {
+  const Bytes& raw = !m_->code_sec.value.empty() ? m_->code_sec.value
+                                                 : d_->detached_code_.value;
+  if (i >= d_->code_sources_.size()) {
+    return nullptr;
+  }
+  const auto& src = d_->code_sources_[i];
+  if (src.end > raw.size() || src.func.lock() != d_->cs_[i].code) {
+    return nullptr;
+  }
+  *size = src.end - src.start;
+  return raw.data() + src.start;
+}
+
+void ModuleWriter::writeCodeSection(Section* section,
+                                    OutputBuffer* out) const {
+  // Bodies are independent, so the replaced ones are encoded in parallel and
+  // then concatenated in order. The others are copied as they were parsed.
+  std::vector<Bytes> bodies(d_->cs_.size());
+  pool_->parallelFor(bodies.size(), [this, &bodies](size_t i) {
+    size_t size;
+    if (codeSource(i, &size) != nullptr) {
+      return;
+    }
+    VectorOutputBuffer body;
+    encodeFunc(*d_->cs_[i].code, &body);
+    bodies[i] = body.release();
+  });
+  OutputBuffer* fields = &section->fields;
+  fields->writeU32(bodies.size());
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    size_t size;
+    if (const Byte* src = codeSource(i, &size)) {
+      section->addRange(src, size);
+      continue;
+    }
+    fields->writeU32(bodies[i].size());
+    section->addRange(bodies[i].data(), bodies[i].size());
+  }
+  section->writeTo(SectionId::Code, out);
+}
+
+void ModuleWriter::encodeFunc(const Func& f, OutputBuffer* out) {
+  out->writeU32(f.locals.size());
+  for (const auto& l : f.locals) {
+    out->writeU32(l.n);
+    out->writeByte(static_cast<Byte>(l.t));
+  }
+  encodeExpr(f.expr, out);
+}
+
+void ModuleWriter::encodeExpr(const std::vector<Instruction>& instrs,
+                              OutputBuffer* out) {
+  for (const auto& i : instrs) {
+    encodeInstruction(i, out);
+  }
+  out->writeByte(0x0B);
+}
+
+void ModuleWriter::encodeInstruction(const Instruction& i, OutputBuffer* out) {
+  switch (i.type) {
+    case InstructionType::SingleOperandControl:
+      out->writeByte(
+          static_cast<Byte>(i.single_operand_control_instruction.type));
+      break;
+    case InstructionType::Block: {
+      const auto& bi = i.block_instruction;
+      out->writeByte(static_cast<Byte>(bi.type));
+      switch (bi.block_type) {
+        case BlockInstruction::BlockType::Empty:
+          out->writeByte(0x40);
+          break;
+        case BlockInstruction::BlockType::ValueType:
+          out->writeByte(static_cast<Byte>(bi.value_type));
+          break;
+        case BlockInstruction::BlockType::TypeIndex:
+          out->writeS64(bi.type_idx);
+          break;
+      }
+      for (const auto& inner : bi.instructions) {
+        encodeInstruction(inner, out);
+      }
+      // An empty else arm is not kept by the decoder, so it is not written.
+      if (!bi.else_instructions.empty()) {
+        out->writeByte(0x05);
+        for (const auto& inner : bi.else_instructions) {
+          encodeInstruction(inner, out);
+        }
+      }
+      out->writeByte(0x0B);
+      break;
+    }
+    case InstructionType::Branch:
+      out->writeByte(static_cast<Byte>(i.branch_instruction.type));
+      out->writeU32(i.branch_instruction.index);
+      break;
+    case InstructionType::TableBranch:
+      out->writeByte(0x0E);
+      out->writeU32(i.table_branch_instruction.l.size());
+      for (auto l : i.table_branch_instruction.l) {
+        out->writeU32(l);
+      }
+      out->writeU32(i.table_branch_instruction.ln);
+      break;
+    case InstructionType::Call:
+      out->writeByte(static_cast<Byte>(i.call_instruction.type));
+      out->writeU32(i.call_instruction.index);
+      if (i.call_instruction.type == CallInstruction::Type::CALL_INDIRECT) {
+        out->writeByte(0x00);
+      }
+      break;
+    case InstructionType::Parametric:
+      out->writeByte(static_cast<Byte>(i.parametric_instruction.type));
+      break;
+    case InstructionType::Variable:
+      out->writeByte(static_cast<Byte>(i.variable_instruction.type));
+      out->writeU32(i.variable_instruction.idx);
+      break;
+    case InstructionType::BasicMemory:
+      out->writeByte(static_cast<Byte>(i.basic_memory_instruction.type));
+      encodeMemoryArgument(i.basic_memory_instruction.arg, out);
+      break;
+    case InstructionType::MemorySize:
+      out->writeByte(static_cast<Byte>(i.memory_size_instruction.type));
+      out->writeByte(0x00);
+      break;
+    case InstructionType::Numeric:
+      out->writeByte(static_cast<Byte>(i.numeric_instruction.type));
+      break;
+    case InstructionType::NumericConst: {
+      const auto& nci = i.numeric_const_instruction;
+      out->writeByte(static_cast<Byte>(nci.type));
+      // Floats are stored little endian, as the decoder reads them.
+      switch (nci.type) {
+        case NumericConstInstruction::Type::I32_CONST:
+          out->writeS64(nci.i32_value);
+          break;
+        case NumericConstInstruction::Type::I64_CONST:
+          out->writeS64(nci.i64_value);
+          break;
+        case NumericConstInstruction::Type::F32_CONST:
+          out->write(reinterpret_cast<const Byte*>(&nci.f32_value),
+                     sizeof(nci.f32_value));
+          break;
+        case NumericConstInstruction::Type::F64_CONST:
+          out->write(reinterpret_cast<const Byte*>(&nci.f64_value),
+                     sizeof(nci.f64_value));
+          break;
+      }
+      break;
+    }
+    case InstructionType::Simd: {
+      const auto& si = i.simd_instruction;
+      auto op = static_cast<uint32_t>(si.type);
+      out->writeByte(0xFD);
+      out->writeU32(op);
+      if (SimdInstruction::hasMemoryArgument(op)) {
+        encodeMemoryArgument(si.arg, out);
+      }
+      if (SimdInstruction::hasLane(op)) {
+        out->writeByte(si.lane);
+      }
+      break;
+    }
+    case InstructionType::SimdConst:
+      out->writeByte(0xFD);
+      out->writeU32(0x0C);
+      out->write(i.simd_const_instruction.value.data(), sizeof(V128));
+      break;
+    case InstructionType::SimdShuffle:
+      out->writeByte(0xFD);
+      out->writeU32(0x0D);
+      out->write(i.simd_shuffle_instruction.lanes.data(), sizeof(V128));
+      break;
+    case InstructionType::SaturatingTruncation:
+      out->writeByte(0xFC);
+      out->writeU32(
+          static_cast<uint32_t>(i.saturating_truncation_instruction.type));
+      break;
+    case InstructionType::BulkMemory: {
+      const auto& bmi = i.bulk_memory_instruction;
+      out->writeByte(0xFC);
+      out->writeU32(static_cast<uint32_t>(bmi.type));
+      switch (bmi.type) {
+        case BulkMemoryInstruction::Type::MEMORY_INIT:
+        case BulkMemoryInstruction::Type::TABLE_INIT:
+          out->writeU32(bmi.segment_idx);
+          out->writeU32(bmi.dst_idx);
+          break;
+        case BulkMemoryInstruction::Type::DATA_DROP:
+        case BulkMemoryInstruction::Type::ELEM_DROP:
+          out->writeU32(bmi.segment_idx);
+          break;
+        case BulkMemoryInstruction::Type::MEMORY_COPY:
+        case BulkMemoryInstruction::Type::TABLE_COPY:
+          out->writeU32(bmi.dst_idx);
+          out->writeU32(bmi.src_idx);
+          break;
+        case BulkMemoryInstruction::Type::MEMORY_FILL:
+        case BulkMemoryInstruction::Type::TABLE_GROW:
+        case BulkMemoryInstruction::Type::TABLE_SIZE:
+        case BulkMemoryInstruction::Type::TABLE_FILL:
+          out->writeU32(bmi.dst_idx);
+          break;
+      }
+      break;
+    }
+    case InstructionType::Atomic:
+      out->writeByte(0xFE);
+      out->writeU32(static_cast<uint32_t>(i.atomic_instruction.type));
+      if (i.atomic_instruction.type ==
+          AtomicInstruction::Type::ATOMIC_FENCE) {
+        out->writeByte(0x00);
+      } else {
+        encodeMemoryArgument(i.atomic_instruction.arg, out);
+      }
+      break;
+  }
+}
+
+void ModuleWriter::encodeName(const Name& name, OutputBuffer* out) {
+  out->writeU32(name.size());
+  out->write(name.data(), name.size());
+}
+
+void ModuleWriter::encodeLimits(const Limit& l, OutputBuffer* out) {
+  Byte flag = 0x00;
+  if (l.max_.has_value()) {
+    flag |= 0x01;
+  }
+  if (l.shared) {
+    flag |= 0x02;
+  }
+  if (l.is64) {
+    flag |= 0x04;
+  }
+  out->writeByte(flag);
+  out->writeU64(l.min_);
+  if (l.max_.has_value()) {
+    out->writeU64(*l.max_);
+  }
+}
+
+void ModuleWriter::encodeMemoryArgument(
+    const BasicMemoryInstruction::MemoryArgument& arg, OutputBuffer* out) {
+  out->writeU32(arg.align);
+  out->writeU64(arg.offset);
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_MODULE_WRITER_H
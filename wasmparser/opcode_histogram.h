@@ -0,0 +1,280 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_OPCODE_HISTOGRAM_H
+#define WASMPARSER_CPP_OPCODE_HISTOGRAM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "instruction_decoder.h"
+#include "parser.h"
+#include "thread_pool.h"
+
+namespace wasmparser {
+
+// Static instruction statistics of function bodies, used to tune the
+// dispatch of an interpreter and to pick superinstructions. Histograms only
+// hold counts, so the histograms of modules can be collected independently
+// and merged in any order.
+//
+// Opcodes are packed into 20 bits: single-byte opcodes as they are, and
+// prefixed opcodes as the prefix byte above their 12-bit sub-opcode, e.g.
+// 0xFD00C for v128.const. N-grams are taken over consecutive instructions
+// of the same instruction sequence: a block instruction ends the n-grams of
+// its enclosing sequence at itself, and each of its arms starts new ones.
+struct OpcodeHistogram {
+  using Histogram = std::unordered_map<uint64_t, uint64_t>;
+
+  static constexpr uint32_t OPCODE_BITS = 20;
+  // Constants and memory offsets up to this magnitude are counted by value.
+  static constexpr uint64_t SMALL_IMMEDIATE = 256;
+  // Key of constants and offsets larger than SMALL_IMMEDIATE. Negative
+  // constants are keyed by their two's complement, so this isn't the all-ones
+  // key of -1.
+  static constexpr uint64_t LARGE_IMMEDIATE = SMALL_IMMEDIATE + 1;
+
+  uint64_t funcs = 0;
+  uint64_t instructions = 0;
+  Histogram opcodes;
+  // Keys are the packed opcodes in order, the first one in the high bits.
+  Histogram bigrams;
+  Histogram trigrams;
+  // Indices of local.get, local.set and local.tee.
+  Histogram local_indices;
+  // Label indices of br, br_if and br_table, default labels included.
+  Histogram branch_depths;
+  // Values of i32.const and i64.const as two's complement u64.
+  Histogram int_consts;
+  // Offsets and log2 alignments of memory accesses.
+  Histogram memory_offsets;
+  Histogram memory_alignments;
+  // Instructions by the number of blocks enclosing them.
+  Histogram depths;
+  // Functions by the deepest nesting of their blocks.
+  Histogram max_depths;
+
+  static uint32_t opcode(const Instruction& i);
+
+  void addFunc(const Func& f);
+  void addModule(const InstructionDecoder& d);
+  void merge(const OpcodeHistogram& o);
+
+ private:
+  void addSequence(const std::vector<Instruction>& instrs, uint32_t depth,
+                   uint32_t* max_depth);
+  void addImmediates(const Instruction& i);
+  void addMemoryArgument(const BasicMemoryInstruction::MemoryArgument& arg);
+};
+
+// Parses and decodes every file on `pool` and returns their histograms in
+// order. Errors are thrown as by Parser::doParse and InstructionDecoder.
+std::vector<OpcodeHistogram> collectOpcodeHistograms(
+    const std::vector<std::string>& files,
+    ThreadPool* pool = &ThreadPool::global());
+
+uint32_t OpcodeHistogram::opcode(const Instruction& i) {
+  switch (i.type) {
+    case InstructionType::SingleOperandControl:
+      return static_cast<Byte>(i.single_operand_control_instruction.type);
+    case InstructionType::Block:
+      return static_cast<Byte>(i.block_instruction.type);
+    case InstructionType::Branch:
+      return static_cast<Byte>(i.branch_instruction.type);
+    case InstructionType::TableBranch:
+      return 0x0E;
+    case InstructionType::Call:
+      return static_cast<Byte>(i.call_instruction.type);
+    case InstructionType::Parametric:
+      return static_cast<Byte>(i.parametric_instruction.type);
+    case InstructionType::Variable:
+      return static_cast<Byte>(i.variable_instruction.type);
+    case InstructionType::BasicMemory:
+      return static_cast<Byte>(i.basic_memory_instruction.type);
+    case InstructionType::MemorySize:
+      return static_cast<Byte>(i.memory_size_instruction.type);
+    case InstructionType::Numeric:
+      return static_cast<Byte>(i.numeric_instruction.type);
+    case InstructionType::NumericConst:
+      return static_cast<Byte>(i.numeric_const_instruction.type);
+    case InstructionType::Simd:
+      return 0xFD000 | static_cast<uint32_t>(i.simd_instruction.type);
+    case InstructionType::SimdConst:
+      return 0xFD00C;
+    case InstructionType::SimdShuffle:
+      return 0xFD00D;
+    case InstructionType::SaturatingTruncation:
+      return 0xFC000 |
+             static_cast<uint32_t>(i.saturating_truncation_instruction.type);
+    case InstructionType::BulkMemory:
+      return 0xFC000 | static_cast<uint32_t>(i.bulk_memory_instruction.type);
+    case InstructionType::Atomic:
+      return 0xFE000 | static_cast<uint32_t>(i.atomic_instruction.type);
+  }
+  return 0;
+}
+
+void OpcodeHistogram::addFunc(const Func& f) {
+  ++funcs;
+  uint32_t max_depth = 0;
+  addSequence(f.expr, 0, &max_depth);
+  ++max_depths[max_depth];
+}
+
+void OpcodeHistogram::addModule(const InstructionDecoder& d) {
+  for (const auto& c : d.cs_) {
+    addFunc(*c.code);
+  }
+}
+
+void OpcodeHistogram::merge(const OpcodeHistogram& o) {
+  funcs += o.funcs;
+  instructions += o.instructions;
+  auto add = [](Histogram* to, const Histogram& from) {
+    for (const auto& [key, count] : from) {
+      (*to)[key] += count;
+    }
+  };
+  add(&opcodes, o.opcodes);
+  add(&bigrams, o.bigrams);
+  add(&trigrams, o.trigrams);
+  add(&local_indices, o.local_indices);
+  add(&branch_depths, o.branch_depths);
+  add(&int_consts, o.int_consts);
+  add(&memory_offsets, o.memory_offsets);
+  add(&memory_alignments, o.memory_alignments);
+  add(&depths, o.depths);
+  add(&max_depths, o.max_depths);
+}
+
+void OpcodeHistogram::addSequence(const std::vector<Instruction>& instrs,
+                                  uint32_t depth, uint32_t* max_depth) {
+  *max_depth = std::max(*max_depth, depth);
+  // Opcodes of the previous two instructions, the latest in the low bits.
+  uint64_t window = 0;
+  size_t n = 0;
+  for (const auto& i : instrs) {
+    uint64_t op = opcode(i);
+    ++instructions;
+    ++opcodes[op];
+    ++depths[depth];
+    if (n >= 1) {
+      ++bigrams[((window & ((1u << OPCODE_BITS) - 1)) << OPCODE_BITS) | op];
+    }
+    if (n >= 2) {
+      ++trigrams[(window << OPCODE_BITS) | op];
+    }
+    window = ((window << OPCODE_BITS) | op) &
+             ((uint64_t(1) << (2 * OPCODE_BITS)) - 1);
+    ++n;
+    addImmediates(i);
+    if (i.type == InstructionType::Block) {
+      addSequence(i.block_instruction.instructions, depth + 1, max_depth);
+      addSequence(i.block_instruction.else_instructions, depth + 1,
+                  max_depth);
+    }
+  }
+}
+
+void OpcodeHistogram::addImmediates(const Instruction& i) {
+  switch (i.type) {
+    case InstructionType::Variable: {
+      auto t = i.variable_instruction.type;
+      if (t == VariableInstruction::Type::LOCAL_GET ||
+          t == VariableInstruction::Type::LOCAL_SET ||
+          t == VariableInstruction::Type::LOCAL_TEE) {
+        ++local_indices[i.variable_instruction.idx];
+      }
+      break;
+    }
+    case InstructionType::Branch:
+      ++branch_depths[i.branch_instruction.index];
+      break;
+    case InstructionType::TableBranch:
+      for (auto l : i.table_branch_instruction.l) {
+        ++branch_depths[l];
+      }
+      ++branch_depths[i.table_branch_instruction.ln];
+      break;
+    case InstructionType::NumericConst: {
+      const auto& nci = i.numeric_const_instruction;
+      int64_t v;
+      if (nci.type == NumericConstInstruction::Type::I32_CONST) {
+        v = nci.i32_value;
+      } else if (nci.type == NumericConstInstruction::Type::I64_CONST) {
+        v = nci.i64_value;
+      } else {
+        break;
+      }
+      bool small = -static_cast<int64_t>(SMALL_IMMEDIATE) <= v &&
+                   v <= static_cast<int64_t>(SMALL_IMMEDIATE);
+      ++int_consts[small ? static_cast<uint64_t>(v) : LARGE_IMMEDIATE];
+      break;
+    }
+    case InstructionType::BasicMemory:
+      addMemoryArgument(i.basic_memory_instruction.arg);
+      break;
+    case InstructionType::Simd: {
+      auto op = static_cast<uint32_t>(i.simd_instruction.type);
+      if (SimdInstruction::hasMemoryArgument(op)) {
+        addMemoryArgument(i.simd_instruction.arg);
+      }
+      break;
+    }
+    case InstructionType::Atomic:
+      if (i.atomic_instruction.type !=
+          AtomicInstruction::Type::ATOMIC_FENCE) {
+        addMemoryArgument(i.atomic_instruction.arg);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void OpcodeHistogram::addMemoryArgument(
+    const BasicMemoryInstruction::MemoryArgument& arg) {
+  ++memory_offsets[arg.offset <= SMALL_IMMEDIATE ? arg.offset
+                                                 : LARGE_IMMEDIATE];
+  ++memory_alignments[arg.align];
+}
+
+std::vector<OpcodeHistogram> collectOpcodeHistograms(
+    const std::vector<std::string>& files, ThreadPool* pool) {
+  std::vector<OpcodeHistogram> histograms(files.size());
+  pool->parallelFor(files.size(), [&](size_t i) {
+    auto m = Parser::doParse(files[i]);
+    InstructionDecoder d(&m);
+    histograms[i].addModule(d);
+  });
+  return histograms;
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_OPCODE_HISTOGRAM_H
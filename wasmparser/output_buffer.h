@@ -0,0 +1,201 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_OUTPUT_BUFFER_H
+#define WASMPARSER_CPP_OUTPUT_BUFFER_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "leb128.h"
+#include "value.h"
+
+namespace wasmparser {
+
+// Destination of ModuleWriter. Appending is non-virtual; subclasses only
+// provide storage when the buffer runs out of capacity.
+class OutputBuffer {
+ public:
+  OutputBuffer() = default;
+  OutputBuffer(const OutputBuffer&) = delete;
+  OutputBuffer& operator=(const OutputBuffer&) = delete;
+  virtual ~OutputBuffer() = default;
+
+  Byte* data() { return data_; }
+  const Byte* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  void writeByte(Byte b) {
+    ensureCapacity(1);
+    data_[size_++] = b;
+  }
+  void write(const Byte* bytes, size_t n) {
+    if (n == 0) {
+      return;
+    }
+    ensureCapacity(n);
+    std::memcpy(data_ + size_, bytes, n);
+    size_ += n;
+  }
+  void writeU32(uint32_t v) { writeU64(v); }
+  void writeU64(uint64_t v) {
+    ensureCapacity(MAX_LEB128_LENGTH);
+    size_ += encodeULEB128(v, data_ + size_);
+  }
+  void writeS64(int64_t v) {
+    ensureCapacity(MAX_LEB128_LENGTH);
+    size_ += encodeSLEB128(v, data_ + size_);
+  }
+  // Drops the written bytes, keeping the storage for the next ones.
+  void clear() { size_ = 0; }
+
+ protected:
+  // Makes room for at least `capacity` bytes, keeping the written ones, and
+  // updates data_ and capacity_.
+  virtual void grow(size_t capacity) = 0;
+
+  Byte* data_{nullptr};
+  size_t size_{0};
+  size_t capacity_{0};
+
+ private:
+  void ensureCapacity(size_t n) {
+    if (size_ + n > capacity_) {
+      grow(std::max(size_ + n, capacity_ * 2));
+    }
+  }
+};
+
+// Output held in memory.
+class VectorOutputBuffer : public OutputBuffer {
+ public:
+  VectorOutputBuffer() = default;
+  explicit VectorOutputBuffer(size_t capacity) { grow(capacity); }
+
+  // Moves the written bytes out, leaving the buffer empty.
+  Bytes release();
+
+ protected:
+  void grow(size_t capacity) override;
+
+ private:
+  Bytes buf_;
+};
+
+// Output written to a file through a shared mapping, so that the written
+// bytes go straight to the page cache. The file is created or truncated on
+// construction and cut to the written size by close().
+class MmapOutputBuffer : public OutputBuffer {
+ public:
+  explicit MmapOutputBuffer(std::string_view filename);
+  ~MmapOutputBuffer() override;
+
+  void close();
+
+ protected:
+  void grow(size_t capacity) override;
+
+ private:
+  int fd_{-1};
+};
+
+void VectorOutputBuffer::grow(size_t capacity) {
+  buf_.resize(capacity);
+  data_ = buf_.data();
+  capacity_ = capacity;
+}
+
+Bytes VectorOutputBuffer::release() {
+  buf_.resize(size_);
+  Bytes out = std::move(buf_);
+  buf_.clear();
+  data_ = nullptr;
+  size_ = 0;
+  capacity_ = 0;
+  return out;
+}
+
+MmapOutputBuffer::MmapOutputBuffer(std::string_view filename) {
+  fd_ = ::open(std::string(filename).c_str(), O_RDWR | O_CREAT | O_TRUNC,
+               0644);
+  if (fd_ < 0) {
+    throw std::runtime_error("Failed to open output file.");
+  }
+}
+
+MmapOutputBuffer::~MmapOutputBuffer() {
+  try {
+    close();
+  } catch (...) {
+  }
+}
+
+void MmapOutputBuffer::grow(size_t capacity) {
+  // Grow in whole pages of 64 KiB at least, as each remap costs a syscall.
+  capacity = std::max<size_t>((capacity + 0xFFFF) & ~size_t{0xFFFF}, 0x10000);
+  if (::ftruncate(fd_, capacity) != 0) {
+    throw std::runtime_error("Failed to extend output file.");
+  }
+  void* p;
+  if (data_ == nullptr) {
+    p = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  } else {
+    p = ::mremap(data_, capacity_, capacity, MREMAP_MAYMOVE);
+  }
+  if (p == MAP_FAILED) {
+    throw std::runtime_error("Failed to map output file.");
+  }
+  data_ = static_cast<Byte*>(p);
+  capacity_ = capacity;
+}
+
+void MmapOutputBuffer::close() {
+  if (fd_ < 0) {
+    return;
+  }
+  if (data_ != nullptr) {
+    ::munmap(data_, capacity_);
+    data_ = nullptr;
+    capacity_ = 0;
+  }
+  int res = ::ftruncate(fd_, size_);
+  ::close(fd_);
+  fd_ = -1;
+  if (res != 0) {
+    throw std::runtime_error("Failed to truncate output file.");
+  }
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_OUTPUT_BUFFER_H
@@ -0,0 +1,82 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_PARSE_WORKSPACE_H
+#define WASMPARSER_CPP_PARSE_WORKSPACE_H
+
+#include <string_view>
+
+#include "instruction_decoder.h"
+#include "module.h"
+#include "parser.h"
+
+namespace wasmparser {
+
+// A parser, a module and a decoder which are reused for every module parsed
+// through the workspace. The input buffer, the sections and the decoded
+// bodies of one module are parsed into the storage of the previous one, so
+// that a long-lived worker thread parsing module after module reaches a
+// steady state with little allocator traffic.
+class ParseWorkspace {
+ public:
+  // Workspace of the calling thread.
+  static ParseWorkspace& local();
+
+  ParseWorkspace() = default;
+  // The decoder points into the module.
+  ParseWorkspace(const ParseWorkspace&) = delete;
+  ParseWorkspace& operator=(const ParseWorkspace&) = delete;
+
+  // Parses and decodes `filename`, replacing the previous module. Throws
+  // std::runtime_error like Parser::doParse and the InstructionDecoder
+  // constructor.
+  void parse(std::string_view filename, DecoderOptions options = {});
+
+  // The last parsed module and its decoder, valid until the next parse().
+  Module* module() { return &module_; }
+  InstructionDecoder* decoder() { return &decoder_; }
+
+ private:
+  Parser parser_;
+  Module module_;
+  InstructionDecoder decoder_;
+};
+
+ParseWorkspace& ParseWorkspace::local() {
+  thread_local ParseWorkspace workspace;
+  return workspace;
+}
+
+void ParseWorkspace::parse(std::string_view filename, DecoderOptions options) {
+  // The decoder refers to the module, so it lets go of it before the module
+  // is cleared.
+  decoder_.reset();
+  parser_.parse(filename, &module_);
+  decoder_.decode(&module_, options);
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_PARSE_WORKSPACE_H
@@ -26,31 +26,57 @@
 #ifndef WASMPARSER_CPP_PARSER_H
 #define WASMPARSER_CPP_PARSER_H
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <limits>
 #include <string_view>
 
 #include "buffer.h"
 #include "leb128.h"
 #include "module.h"
+#include "section_directory.h"
+#include "thread_pool.h"
 #include "value.h"
 
 namespace wasmparser {
-namespace {
-static constexpr std::array<Byte, 4> MAGIC = {0x00, 0x61, 0x73, 0x6D};
-static constexpr std::array<Byte, 4> VERSION = {0x01, 0x00, 0x00, 0x00};
-}  // namespace
 
 class Parser {
  public:
+  Parser() = default;
   Parser(ZeroCopyBufferPtr buf) : buf_(std::move(buf)) {}
   static Module doParse(std::string_view filename);
+  // Parses `filename` into `m` like doParse, after clearing `m`. The file is
+  // read into the buffer of the previous call and the sections, names and
+  // custom section bytes included, into the storage of the previous module,
+  // so that a long-lived parser and module parse module after module with
+  // few allocations.
+  void parse(std::string_view filename, Module* m);
+  // Rewinds the parser to the start of its buffer.
+  void reset();
+  // Parses the sections in `buf` into `m`. `buf` holds whole sections
+  // without the module header, starting at module offset `offset`, so that
+  // a module can be parsed a part at a time. Index spaces are left to
+  // Module::buildIndexSpaces once every part is parsed.
+  static bool doParseSections(ZeroCopyBufferPtr buf, size_t offset,
+                              Module* m);
+  // Parses like doParse, but scans the section headers first, see
+  // scanSections, and then parses the sections concurrently on `pool`.
+  // Pass the pool as DecoderOptions::pool to decode the function bodies
+  // concurrently as well.
+  static Module doParseParallel(std::string_view filename,
+                                ThreadPool* pool = &ThreadPool::global());
 
  private:
   bool isEnd();
   bool checkMagicField();
   bool checkVersionField();
   bool doParseSection(Module* m);
+  // Parses the section at idx_.
+  bool doParseOneSection(Module* m);
+  // Moves section `id` of `from` into `to`, or appends it for custom
+  // sections.
+  static void moveSection(SectionId id, Module* from, Module* to);
   int32_t doParseCustomSection(CustomSection* cs);
   int32_t doParseTypeSection(TypeSection* ts);
   int32_t doParseFuncType(FuncType* ft);
@@ -58,6 +84,7 @@ class Parser {
   int32_t doParseValueTypes(ValueType* val);
   int32_t doParseResultTypes(ResultType* rt);
   int32_t doParseU32Integer(uint32_t* size);
+  int32_t doParseU64Integer(uint64_t* size);
   int32_t doParseImportDesc(Import::ImportDescVariant* vd);
   int32_t doParseImport(Import* ip);
   int32_t doParseImportSection(ImportSection* is);
@@ -73,10 +100,31 @@ class Parser {
   int32_t doParseExportDesc(Export::ExportDesc* ed);
   int32_t doParseExport(Export* e);
   int32_t doParseStartSection(StartSection* ss);
+  int32_t doParseDataCountSection(DataCountSection* dcs);
+  int32_t skipSection();
   int32_t doParseElementSection(RawBufferElementSection* es);
   int32_t doParseCodeSection(RawBufferCodeSection* cs);
   int32_t doParseDataSection(RawBufferDataSection* ds);
 
+  // Reserves room for `n` entries of a vector about to be parsed. Every
+  // entry takes at least a byte, so a corrupt count can't reserve more than
+  // the rest of the buffer.
+  template <class V>
+  void reserveVec(V* v, uint32_t n) {
+    v->reserve(std::min<size_t>(n, buf_->size() - idx_));
+  }
+
+  // Appends the next `n` bytes to `out` at once.
+  void copyBytes(size_t n, Bytes* out) {
+    if (n == 0) {
+      return;
+    }
+    // Throws like a byte-wise read if the range is out of bounds.
+    buf_->at(idx_ + n - 1);
+    out->insert(out->end(), buf_->at(idx_), buf_->at(idx_) + n);
+    idx_ += n;
+  }
+
   uint32_t fetchVecSize() {
     uint32_t size;
     if (doParseU32Integer(&size) < 0) {
@@ -86,14 +134,68 @@ class Parser {
   }
 
   size_t idx_{8};
+  // Module offset of buf_[0].
+  size_t base_offset_{0};
   ZeroCopyBufferPtr buf_;
+  // Entries of the module parse() parsed before, whose names and bytes the
+  // entries of the next module take over.
+  std::vector<Import> spare_imports_;
+  std::vector<Export> spare_exports_;
+  std::vector<CustomSection> spare_customs_;
 };
 
 bool Parser::isEnd() { return buf_->size() <= idx_; }
 
 Module Parser::doParse(std::string_view filename) {
-  auto buf = ZeroCopyBuffer::createBuffer(filename);
+  Module m;
+  Parser p;
+  p.parse(filename, &m);
+  return m;
+}
+
+void Parser::parse(std::string_view filename, Module* m) {
+  // The buffer may still be shared with a previous caller.
+  if (buf_ != nullptr && buf_.use_count() == 1) {
+    buf_->load(filename);
+  } else {
+    buf_ = ZeroCopyBuffer::createBuffer(filename);
+  }
+  reset();
+
+  if (!checkMagicField()) {
+    throw std::runtime_error("Invalid magic number");
+  }
+
+  if (!checkVersionField()) {
+    throw std::runtime_error("Invalid version number");
+  }
+
+  keepSpares(&m->import_sec.value, &spare_imports_);
+  keepSpares(&m->export_sec.value, &spare_exports_);
+  keepSpares(&m->custom_sec, &spare_customs_);
+  m->clear();
+  if (!doParseSection(m)) {
+    throw std::runtime_error("Failed to parse sections");
+  }
+  m->buildIndexSpaces();
+}
+
+void Parser::reset() {
+  idx_ = 8;
+  base_offset_ = 0;
+}
+
+bool Parser::doParseSections(ZeroCopyBufferPtr buf, size_t offset,
+                             Module* m) {
   Parser p(std::move(buf));
+  p.idx_ = 0;
+  p.base_offset_ = offset;
+  return p.doParseSection(m);
+}
+
+Module Parser::doParseParallel(std::string_view filename, ThreadPool* pool) {
+  ZeroCopyBufferPtr buf = ZeroCopyBuffer::createBuffer(filename);
+  Parser p(buf);
 
   if (!p.checkMagicField()) {
     throw std::runtime_error("Invalid magic number");
@@ -103,118 +205,185 @@ Module Parser::doParse(std::string_view filename) {
     throw std::runtime_error("Invalid version number");
   }
 
+  auto dir = scanSections(buf->at(0), buf->size());
+  const auto& sections = dir.sections;
+  // Sections only write their own fields of a module, but custom sections
+  // and the section order are appended to, so every section is parsed into
+  // a module of its own and moved into the result in order.
+  std::vector<Module> parts(sections.size());
+  std::unique_ptr<bool[]> parsed(new bool[sections.size()]());
+  pool->parallelFor(sections.size(), [&](size_t i) {
+    Parser section_parser(buf);
+    section_parser.idx_ = sections[i].start;
+    parsed[i] = section_parser.doParseOneSection(&parts[i]) &&
+                section_parser.idx_ == sections[i].end();
+  });
+
   Module m;
-  if (!p.doParseSection(&m)) {
-    throw std::runtime_error("Failed to parse sections");
+  for (size_t i = 0; i < sections.size(); ++i) {
+    if (!parsed[i]) {
+      throw std::runtime_error("Failed to parse sections");
+    }
+    // Unknown sections leave the order empty.
+    for (auto id : parts[i].section_order) {
+      moveSection(id, &parts[i], &m);
+      m.section_order.emplace_back(id);
+    }
   }
+  m.buildIndexSpaces();
   return m;
 }
 
+void Parser::moveSection(SectionId id, Module* from, Module* to) {
+  switch (id) {
+    case SectionId::Custom:
+      for (auto& cs : from->custom_sec) {
+        to->custom_sec.emplace_back(std::move(cs));
+      }
+      break;
+    case SectionId::Type:
+      to->type_sec = std::move(from->type_sec);
+      break;
+    case SectionId::Import:
+      to->import_sec = std::move(from->import_sec);
+      break;
+    case SectionId::Function:
+      to->func_sec = std::move(from->func_sec);
+      break;
+    case SectionId::Table:
+      to->table_sec = std::move(from->table_sec);
+      break;
+    case SectionId::Memory:
+      to->mem_sec = std::move(from->mem_sec);
+      break;
+    case SectionId::Global:
+      to->global_sec = std::move(from->global_sec);
+      break;
+    case SectionId::Export:
+      to->export_sec = std::move(from->export_sec);
+      break;
+    case SectionId::Start:
+      to->start_sec = std::move(from->start_sec);
+      break;
+    case SectionId::Element:
+      to->element_sec = std::move(from->element_sec);
+      break;
+    case SectionId::Code:
+      to->code_sec = std::move(from->code_sec);
+      break;
+    case SectionId::Data:
+      to->data_sec = std::move(from->data_sec);
+      break;
+    case SectionId::DataCount:
+      to->data_count_sec = std::move(from->data_count_sec);
+      break;
+  }
+}
+
 bool Parser::doParseSection(Module* m) {
   while (!isEnd()) {
-    auto section_id = static_cast<SectionId>(*buf_->at(idx_));
-    ++idx_;
-    switch (section_id) {
-      case SectionId::Custom: {
-        CustomSection cs;
-        if (doParseCustomSection(&cs) < 0) {
-          return false;
-        }
-        m->custom_sec.emplace_back(cs);
-        break;
+    if (!doParseOneSection(m)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Parser::doParseOneSection(Module* m) {
+  auto section_id = static_cast<SectionId>(*buf_->at(idx_));
+  ++idx_;
+  // Sections are parsed in place, into the storage Module::clear keeps.
+  switch (section_id) {
+    case SectionId::Custom: {
+      CustomSection cs;
+      if (m->custom_sec.size() < spare_customs_.size()) {
+        auto& spare = spare_customs_[m->custom_sec.size()].value;
+        reuseStorage(&spare.name, &cs.value.name);
+        reuseStorage(&spare.bytes, &cs.value.bytes);
       }
-      case SectionId::Type: {
-        TypeSection ts;
-        if (doParseTypeSection(&ts) < 0) {
-          return false;
-        }
-        m->type_sec = ts;
-        break;
+      if (doParseCustomSection(&cs) < 0) {
+        return false;
       }
-      case SectionId::Import: {
-        ImportSection is;
-        if (doParseImportSection(&is) < 0) {
-          return false;
-        }
-        m->import_sec = is;
-        break;
+      m->custom_sec.emplace_back(std::move(cs));
+      break;
+    }
+    case SectionId::Type:
+      m->type_sec.clear();
+      if (doParseTypeSection(&m->type_sec) < 0) {
+        return false;
       }
-      case SectionId::Function: {
-        FuncSection fs;
-        if (doParseFunctionSection(&fs) < 0) {
-          return false;
-        }
-        m->func_sec = fs;
-        break;
+      break;
+    case SectionId::Import:
+      m->import_sec.clear();
+      if (doParseImportSection(&m->import_sec) < 0) {
+        return false;
       }
-      case SectionId::Table: {
-        TableSection ts;
-        if (doParseTableSection(&ts) < 0) {
-          return false;
-        }
-        m->table_sec = ts;
-        break;
+      break;
+    case SectionId::Function:
+      m->func_sec.clear();
+      if (doParseFunctionSection(&m->func_sec) < 0) {
+        return false;
       }
-      case SectionId::Start: {
-        StartSection ss;
-        if (doParseStartSection(&ss) < 0) {
-          return false;
-        }
-        m->start_sec = ss;
-        break;
+      break;
+    case SectionId::Table:
+      m->table_sec.clear();
+      if (doParseTableSection(&m->table_sec) < 0) {
+        return false;
       }
-      case SectionId::Element: {
-        RawBufferElementSection es;
-        if (doParseElementSection(&es) < 0) {
-          return false;
-        }
-        m->element_sec = es;
-        break;
+      break;
+    case SectionId::Start:
+      m->start_sec.clear();
+      if (doParseStartSection(&m->start_sec) < 0) {
+        return false;
       }
-      case SectionId::Code: {
-        RawBufferCodeSection cs;
-        if (doParseCodeSection(&cs) < 0) {
-          return false;
-        }
-        m->code_sec = cs;
-        break;
+      break;
+    case SectionId::Element:
+      m->element_sec.clear();
+      if (doParseElementSection(&m->element_sec) < 0) {
+        return false;
       }
-      case SectionId::Data: {
-        RawBufferDataSection ds;
-        if (doParseDataSection(&ds) < 0) {
-          return false;
-        }
-        m->data_sec = ds;
-        break;
+      break;
+    case SectionId::Code:
+      m->code_sec.clear();
+      if (doParseCodeSection(&m->code_sec) < 0) {
+        return false;
       }
-      case SectionId::Memory: {
-        MemorySection ms;
-        if (doParseMemorySection(&ms) < 0) {
-          return false;
-        }
-        m->mem_sec = ms;
-        break;
+      break;
+    case SectionId::Data:
+      m->data_sec.clear();
+      if (doParseDataSection(&m->data_sec) < 0) {
+        return false;
       }
-      case SectionId::Export: {
-        ExportSection es;
-        if (doParseExportSection(&es) < 0) {
-          return false;
-        }
-        m->export_sec = es;
-        break;
+      break;
+    case SectionId::Memory:
+      m->mem_sec.clear();
+      if (doParseMemorySection(&m->mem_sec) < 0) {
+        return false;
       }
-      case SectionId::Global: {
-        RawBufferGlobalSection gs;
-        if (doParseGlobalSection(&gs) < 0) {
-          return false;
-        }
-        m->global_sec = gs;
-        break;
+      break;
+    case SectionId::Export:
+      m->export_sec.clear();
+      if (doParseExportSection(&m->export_sec) < 0) {
+        return false;
       }
-      default:
-        break;
-    }
+      break;
+    case SectionId::Global:
+      m->global_sec.clear();
+      if (doParseGlobalSection(&m->global_sec) < 0) {
+        return false;
+      }
+      break;
+    case SectionId::DataCount:
+      m->data_count_sec.clear();
+      if (doParseDataCountSection(&m->data_count_sec) < 0) {
+        return false;
+      }
+      break;
+    default:
+      // Unknown sections are dropped.
+      return skipSection() >= 0;
   }
+  m->section_order.emplace_back(section_id);
   return true;
 }
 
@@ -227,6 +396,8 @@ int32_t Parser::doParseValueTypes(ValueType* val) {
     *val = ValueType::F32;
   } else if (*buf_->at(idx_) == 0x7C) {
     *val = ValueType::F64;
+  } else if (*buf_->at(idx_) == 0x7B) {
+    *val = ValueType::V128;
   } else {
     return -1;
   }
@@ -315,17 +486,20 @@ int32_t Parser::doParseExport(Export* e) {
 
 int32_t Parser::doParseExportSection(ExportSection* es) {
   size_t start_idx = idx_;
-  ++idx_;
   if (doParseU32Integer(&es->size) < 0) {
     return -1;
   }
   size_t vec_size = fetchVecSize();
+  reserveVec(&es->value, vec_size);
   while (vec_size > 0) {
     Export e;
+    if (es->value.size() < spare_exports_.size()) {
+      reuseStorage(&spare_exports_[es->value.size()].name, &e.name);
+    }
     if (doParseExport(&e) < 0) {
       return -1;
     }
-    es->value.emplace_back(e);
+    es->value.emplace_back(std::move(e));
     --vec_size;
   }
   return idx_ - start_idx;
@@ -356,6 +530,30 @@ int32_t Parser::doParseStartSection(StartSection* ss) {
   return idx_ - start_idx;
 }
 
+int32_t Parser::doParseDataCountSection(DataCountSection* dcs) {
+  size_t start_idx = idx_;
+  if (doParseU32Integer(&dcs->size) < 0) {
+    return -1;
+  }
+  if (doParseU32Integer(&dcs->value) < 0) {
+    return -1;
+  }
+  return idx_ - start_idx;
+}
+
+int32_t Parser::skipSection() {
+  size_t start_idx = idx_;
+  uint32_t size;
+  if (doParseU32Integer(&size) < 0) {
+    return -1;
+  }
+  if (size > buf_->size() - idx_) {
+    return -1;
+  }
+  idx_ += size;
+  return idx_ - start_idx;
+}
+
 int32_t Parser::doParseElementSection(RawBufferElementSection* es) {
   size_t start_idx = idx_;
   if (doParseU32Integer(&es->size) < 0) {
@@ -366,12 +564,9 @@ int32_t Parser::doParseElementSection(RawBufferElementSection* es) {
   if (u32_byte_len < 0) {
     return -1;
   }
-  size_t vec_bytes = es->size - u32_byte_len;
-  while (vec_bytes > 0) {
-    es->value.emplace_back(*buf_->at(idx_));
-    --vec_bytes;
-    ++idx_;
-  }
+  es->offset = base_offset_ + idx_;
+  es->count = vec_size;
+  copyBytes(es->size - u32_byte_len, &es->value);
   return idx_ - start_idx;
 }
 
@@ -381,6 +576,7 @@ int32_t Parser::doParseFunctionSection(FuncSection* fc) {
     return -1;
   }
   auto vec_size = fetchVecSize();
+  reserveVec(&fc->value, vec_size);
   while (vec_size > 0) {
     uint32_t idx;
     if (doParseU32Integer(&idx) < 0) {
@@ -398,12 +594,18 @@ int32_t Parser::doParseImportSection(ImportSection* is) {
     return -1;
   }
   auto vec_size = fetchVecSize();
+  reserveVec(&is->value, vec_size);
   while (vec_size > 0) {
     Import ip;
+    if (is->value.size() < spare_imports_.size()) {
+      auto& spare = spare_imports_[is->value.size()];
+      reuseStorage(&spare.module_name, &ip.module_name);
+      reuseStorage(&spare.name, &ip.name);
+    }
     if (doParseImport(&ip) < 0) {
       return -1;
     }
-    is->value.emplace_back(ip);
+    is->value.emplace_back(std::move(ip));
     --vec_size;
   }
   return idx_ - start_idx;
@@ -415,6 +617,7 @@ int32_t Parser::doParseTableSection(TableSection* ts) {
     return -1;
   }
   auto vec_size = fetchVecSize();
+  reserveVec(&ts->value, vec_size);
   while (vec_size > 0) {
     TableType tt;
     if (doParseTableTypes(&tt) < 0) {
@@ -436,12 +639,9 @@ int32_t Parser::doParseGlobalSection(RawBufferGlobalSection* gs) {
   if (u32_byte_len < 0) {
     return -1;
   }
-  size_t vec_bytes = gs->size - u32_byte_len;
-  while (vec_bytes > 0) {
-    gs->value.emplace_back(*buf_->at(idx_));
-    --vec_bytes;
-    ++idx_;
-  }
+  gs->offset = base_offset_ + idx_;
+  gs->count = vec_size;
+  copyBytes(gs->size - u32_byte_len, &gs->value);
   return idx_ - start_idx;
 }
 
@@ -455,37 +655,45 @@ int32_t Parser::doParseCodeSection(RawBufferCodeSection* cs) {
   if (u32_byte_len < 0) {
     return -1;
   }
-  size_t vec_bytes = cs->size - u32_byte_len;
-  while (vec_bytes > 0) {
-    cs->value.emplace_back(*buf_->at(idx_));
-    --vec_bytes;
-    ++idx_;
-  }
+  cs->offset = base_offset_ + idx_;
+  cs->count = vec_size;
+  copyBytes(cs->size - u32_byte_len, &cs->value);
   return idx_ - start_idx;
 }
 
 int32_t Parser::doParseLimits(Limit* l) {
   size_t start_idx = idx_;
-  if (*buf_->at(idx_) == 0x00) {
-    ++idx_;
-    if (doParseU32Integer(&l->min_) < 0) {
-      return -1;
-    }
-    l->max_ = std::nullopt;
-    return idx_ - start_idx;
-  } else if (*buf_->at(idx_) == 0x01) {
-    ++idx_;
-    if (doParseU32Integer(&l->min_) < 0) {
-      return -1;
+  // Flags 0x02 and 0x03 are the shared variants of 0x00 and 0x01, and flags
+  // 0x04 to 0x07 are the 64-bit variants of 0x00 to 0x03. Shared memories
+  // must declare a maximum, so 0x02 and 0x06 are invalid.
+  Byte flag = *buf_->at(idx_);
+  if (flag > 0x07 || (flag & 0x03) == 0x02) {
+    return -1;
+  }
+  ++idx_;
+  l->shared = (flag & 0x02) != 0;
+  l->is64 = (flag & 0x04) != 0;
+  auto parse_bound = [this, l](uint64_t* v) {
+    if (l->is64) {
+      return doParseU64Integer(v);
     }
-    uint32_t max;
-    if (doParseU32Integer(&max) < 0) {
+    uint32_t v32;
+    auto res = doParseU32Integer(&v32);
+    *v = v32;
+    return res;
+  };
+  if (parse_bound(&l->min_) < 0) {
+    return -1;
+  }
+  l->max_ = std::nullopt;
+  if ((flag & 0x01) != 0) {
+    uint64_t max;
+    if (parse_bound(&max) < 0) {
       return -1;
     }
     l->max_ = max;
-    return idx_ - start_idx;
   }
-  return -1;
+  return idx_ - start_idx;
 }
 
 int32_t Parser::doParseTableTypes(TableType* tt) {
@@ -498,6 +706,10 @@ int32_t Parser::doParseTableTypes(TableType* tt) {
   if (doParseLimits(&tt->limit) < 0) {
     return -1;
   }
+  // Only memories can be shared or 64-bit.
+  if (tt->limit.shared || tt->limit.is64) {
+    return -1;
+  }
   return idx_ - start_idx;
 }
 
@@ -511,12 +723,9 @@ int32_t Parser::doParseDataSection(RawBufferDataSection* ds) {
   if (u32_byte_len < 0) {
     return -1;
   }
-  size_t vec_bytes = ds->size - u32_byte_len;
-  while (vec_bytes > 0) {
-    ds->value.emplace_back(*buf_->at(idx_));
-    --vec_bytes;
-    ++idx_;
-  }
+  ds->offset = base_offset_ + idx_;
+  ds->count = vec_size;
+  copyBytes(ds->size - u32_byte_len, &ds->value);
 
   return idx_ - start_idx;
 }
@@ -524,6 +733,7 @@ int32_t Parser::doParseDataSection(RawBufferDataSection* ds) {
 int32_t Parser::doParseResultTypes(ResultType* rt) {
   size_t start_idx = idx_;
   auto vec_size = fetchVecSize();
+  reserveVec(rt, vec_size);
   while (vec_size > 0) {
     ValueType val;
     if (doParseValueTypes(&val) < 0) {
@@ -564,12 +774,13 @@ int32_t Parser::doParseTypeSection(TypeSection* ts) {
     return -1;
   }
   auto vec_size = fetchVecSize();
+  reserveVec(&ts->value, vec_size);
   while (vec_size > 0) {
     FuncType ft;
     if (doParseFuncType(&ft) < 0) {
       return -1;
     }
-    ts->value.emplace_back(ft);
+    ts->value.emplace_back(std::move(ft));
     --vec_size;
   }
   return idx_ - start_idx;
@@ -581,6 +792,7 @@ int32_t Parser::doParseMemorySection(MemorySection* ms) {
     return -1;
   }
   auto vec_size = fetchVecSize();
+  reserveVec(&ms->value, vec_size);
   while (vec_size > 0) {
     MemoryType mt;
     if (doParseMemoryTypes(&mt) < 0) {
@@ -617,29 +829,29 @@ int32_t Parser::doParseCustomSection(CustomSection* cs) {
   if (name_size < 0) {
     return -1;
   }
-  auto bytes_rem = cs->size - name_size;
-  while (bytes_rem > 0) {
-    cs->value.bytes.emplace_back(*buf_->at(idx_));
-    ++idx_;
-    --bytes_rem;
-  }
+  copyBytes(cs->size - name_size, &cs->value.bytes);
   return idx_ - start_idx;
 }
 
 int32_t Parser::doParseName(Name* name) {
   size_t start_idx = idx_;
-  auto vec_size = fetchVecSize();
-  while (vec_size > 0) {
-    name->emplace_back(*buf_->at(idx_));
-    ++idx_;
-    --vec_size;
-  }
+  copyBytes(fetchVecSize(), name);
   return idx_ - start_idx;
 }
 
 int32_t Parser::doParseU32Integer(uint32_t* size) {
   size_t start_idx = idx_;
-  auto res = decodeULEB128(buf_->at(idx_), size);
+  auto res = decodeULEB128(buf_->at(idx_), buf_->size() - idx_, size);
+  if (res == 0) {
+    return -1;
+  }
+  idx_ += res;
+  return idx_ - start_idx;
+}
+
+int32_t Parser::doParseU64Integer(uint64_t* size) {
+  size_t start_idx = idx_;
+  auto res = decodeULEB128(buf_->at(idx_), buf_->size() - idx_, size);
   if (res == 0) {
     return -1;
   }
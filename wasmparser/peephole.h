@@ -0,0 +1,440 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_PEEPHOLE_H
+#define WASMPARSER_CPP_PEEPHOLE_H
+
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "instruction_decoder.h"
+#include "module.h"
+#include "stack_effect.h"
+
+namespace wasmparser {
+
+struct PeepholeStats {
+  // Numeric instructions folded together with their constant operands.
+  size_t folded_consts{0};
+  // local.set x; local.get x pairs turned into local.tee x.
+  size_t local_tees{0};
+  size_t removed_nops{0};
+  // br 0 right before the end of the block it leaves.
+  size_t removed_branches{0};
+
+  size_t total() const {
+    return folded_consts + local_tees + removed_nops + removed_branches;
+  }
+};
+
+// Local rewrites of decoded instruction sequences:
+//
+// - Integer numeric instructions whose operands are constants are folded
+//   into a constant. Operations which would trap, such as division by zero,
+//   are kept so that they still trap. Float arithmetic is left alone.
+// - local.set x followed by local.get x becomes local.tee x.
+// - nop is removed.
+// - br 0 as the last instruction of a block or if arm is removed when the
+//   operand stack holds exactly the block results there, so that falling
+//   through to the end is equivalent.
+//
+// Types of `m` are used to compute stack heights around calls and typed
+// blocks. Without a module, branches are only removed from blocks whose
+// stack effects are known without it.
+class PeepholeOptimizer {
+ public:
+  explicit PeepholeOptimizer(const Module* m = nullptr);
+
+  void optimize(std::vector<Instruction>* instrs);
+  void optimize(Func* f) { optimize(&f->expr); }
+
+  const PeepholeStats& stats() const { return stats_; }
+
+ private:
+  void optimizeBlock(BlockInstruction* bi);
+  // Removes a trailing br 0 from an arm of a block of the given arity.
+  void removeTrailingBranch(std::vector<Instruction>* arm,
+                            const StackEffect& arity);
+  bool foldNumeric(NumericInstruction::Type type,
+                   std::vector<Instruction>* out);
+
+  StackEffects effects_;
+  PeepholeStats stats_;
+};
+
+// Optimizes every decoded function body of `d`. Decoded bodies may be
+// shared, so changed bodies are replaced rather than modified. When any body
+// changes, the raw code section of `m` and the code offsets and incremental
+// decoding state of `d` no longer match and are cleared, as by
+// stripDeadFunctions.
+PeepholeStats optimizeCode(Module* m, InstructionDecoder* d);
+
+namespace {
+
+Instruction makeI32Const(uint32_t v) {
+  Instruction i;
+  i.type = InstructionType::NumericConst;
+  i.numeric_const_instruction.type = NumericConstInstruction::Type::I32_CONST;
+  i.numeric_const_instruction.i32_value = static_cast<int32_t>(v);
+  return i;
+}
+
+Instruction makeI64Const(uint64_t v) {
+  Instruction i;
+  i.type = InstructionType::NumericConst;
+  i.numeric_const_instruction.type = NumericConstInstruction::Type::I64_CONST;
+  i.numeric_const_instruction.i64_value = static_cast<int64_t>(v);
+  return i;
+}
+
+// Integer operations of wasm on the unsigned integer of the operand width.
+// Opcodes are relative to the first one of their group: add to rotr,
+// eq to ge_u, and clz to popcnt.
+template <class U>
+std::optional<U> foldIntBinary(Byte op, U a, U b) {
+  constexpr U BITS = sizeof(U) * 8;
+  constexpr U SIGN = U(1) << (BITS - 1);
+  using S = std::make_signed_t<U>;
+  U k = b % BITS;
+  switch (op) {
+    case 0:
+      return U(a + b);
+    case 1:
+      return U(a - b);
+    case 2:
+      return U(a * b);
+    case 3:
+      if (b == 0 || (a == SIGN && b == U(-1))) {
+        return std::nullopt;
+      }
+      return U(S(a) / S(b));
+    case 4:
+      if (b == 0) {
+        return std::nullopt;
+      }
+      return U(a / b);
+    case 5:
+      if (b == 0) {
+        return std::nullopt;
+      }
+      // INT_MIN % -1 is 0 in wasm but overflows in C++.
+      return b == U(-1) ? U(0) : U(S(a) % S(b));
+    case 6:
+      if (b == 0) {
+        return std::nullopt;
+      }
+      return U(a % b);
+    case 7:
+      return U(a & b);
+    case 8:
+      return U(a | b);
+    case 9:
+      return U(a ^ b);
+    case 10:
+      return U(a << k);
+    case 11:
+      if (k == 0) {
+        return a;
+      }
+      return U((a >> k) | ((a & SIGN) != 0 ? ~(~U(0) >> k) : U(0)));
+    case 12:
+      return U(a >> k);
+    case 13:
+      return k == 0 ? a : U((a << k) | (a >> (BITS - k)));
+    case 14:
+      return k == 0 ? a : U((a >> k) | (a << (BITS - k)));
+  }
+  return std::nullopt;
+}
+
+template <class U>
+bool foldIntCompare(Byte op, U a, U b) {
+  using S = std::make_signed_t<U>;
+  switch (op) {
+    case 0:
+      return a == b;
+    case 1:
+      return a != b;
+    case 2:
+      return S(a) < S(b);
+    case 3:
+      return a < b;
+    case 4:
+      return S(a) > S(b);
+    case 5:
+      return a > b;
+    case 6:
+      return S(a) <= S(b);
+    case 7:
+      return a <= b;
+    case 8:
+      return S(a) >= S(b);
+    case 9:
+      return a >= b;
+  }
+  return false;
+}
+
+template <class U>
+U foldIntUnary(Byte op, U a) {
+  constexpr U BITS = sizeof(U) * 8;
+  U n = 0;
+  switch (op) {
+    case 0:
+      while (n < BITS && (a & (U(1) << (BITS - 1 - n))) == 0) {
+        ++n;
+      }
+      break;
+    case 1:
+      while (n < BITS && (a & (U(1) << n)) == 0) {
+        ++n;
+      }
+      break;
+    case 2:
+      for (; a != 0; a &= a - 1) {
+        ++n;
+      }
+      break;
+  }
+  return n;
+}
+
+}  // namespace
+
+PeepholeOptimizer::PeepholeOptimizer(const Module* m) : effects_(m) {}
+
+void PeepholeOptimizer::optimize(std::vector<Instruction>* instrs) {
+  std::vector<Instruction> out;
+  out.reserve(instrs->size());
+  for (auto& i : *instrs) {
+    switch (i.type) {
+      case InstructionType::SingleOperandControl:
+        if (i.single_operand_control_instruction.type ==
+            SingleOperandControlInstruction::Type::NOP) {
+          ++stats_.removed_nops;
+          continue;
+        }
+        break;
+      case InstructionType::Block:
+        optimizeBlock(&i.block_instruction);
+        break;
+      case InstructionType::Numeric:
+        if (foldNumeric(i.numeric_instruction.type, &out)) {
+          ++stats_.folded_consts;
+          continue;
+        }
+        break;
+      case InstructionType::Variable:
+        if (i.variable_instruction.type ==
+                VariableInstruction::Type::LOCAL_GET &&
+            !out.empty() && out.back().type == InstructionType::Variable &&
+            out.back().variable_instruction.type ==
+                VariableInstruction::Type::LOCAL_SET &&
+            out.back().variable_instruction.idx ==
+                i.variable_instruction.idx) {
+          out.back().variable_instruction.type =
+              VariableInstruction::Type::LOCAL_TEE;
+          ++stats_.local_tees;
+          continue;
+        }
+        break;
+      default:
+        break;
+    }
+    out.emplace_back(std::move(i));
+  }
+  *instrs = std::move(out);
+}
+
+void PeepholeOptimizer::optimizeBlock(BlockInstruction* bi) {
+  optimize(&bi->instructions);
+  optimize(&bi->else_instructions);
+  // br 0 of a loop jumps back to its start.
+  if (bi->type == BlockInstruction::Type::LOOP) {
+    return;
+  }
+  auto arity = effects_.blockArity(*bi);
+  if (!arity.has_value()) {
+    return;
+  }
+  removeTrailingBranch(&bi->instructions, *arity);
+  removeTrailingBranch(&bi->else_instructions, *arity);
+}
+
+void PeepholeOptimizer::removeTrailingBranch(std::vector<Instruction>* arm,
+                                             const StackEffect& arity) {
+  if (arm->empty() || arm->back().type != InstructionType::Branch ||
+      arm->back().branch_instruction.type != BranchInstruction::Type::BR ||
+      arm->back().branch_instruction.index != 0) {
+    return;
+  }
+  // br discards values above the results, falling through does not, so
+  // the height before the branch has to match the results exactly.
+  uint32_t height = arity.pops;
+  for (size_t k = 0; k + 1 < arm->size(); ++k) {
+    auto effect = effects_.of((*arm)[k]);
+    if (!effect.has_value() || effect->pops > height) {
+      return;
+    }
+    height = height - effect->pops + effect->pushes;
+  }
+  if (height != arity.pushes) {
+    return;
+  }
+  arm->pop_back();
+  ++stats_.removed_branches;
+}
+
+bool PeepholeOptimizer::foldNumeric(NumericInstruction::Type type,
+                                    std::vector<Instruction>* out) {
+  auto op = static_cast<Byte>(type);
+  auto constAt = [out](size_t back, NumericConstInstruction::Type t)
+      -> const NumericConstInstruction* {
+    if (out->size() < back) {
+      return nullptr;
+    }
+    const auto& i = (*out)[out->size() - back];
+    if (i.type != InstructionType::NumericConst ||
+        i.numeric_const_instruction.type != t) {
+      return nullptr;
+    }
+    return &i.numeric_const_instruction;
+  };
+  constexpr auto I32 = NumericConstInstruction::Type::I32_CONST;
+  constexpr auto I64 = NumericConstInstruction::Type::I64_CONST;
+  auto replace = [out](size_t operands, Instruction c) {
+    out->resize(out->size() - operands);
+    out->emplace_back(std::move(c));
+    return true;
+  };
+
+  bool i32_binary = 0x6A <= op && op <= 0x78;
+  bool i64_binary = 0x7C <= op && op <= 0x8A;
+  bool i32_compare = 0x46 <= op && op <= 0x4F;
+  bool i64_compare = 0x51 <= op && op <= 0x5A;
+  if (i32_binary || i32_compare) {
+    auto* a = constAt(2, I32);
+    auto* b = constAt(1, I32);
+    if (a == nullptr || b == nullptr) {
+      return false;
+    }
+    auto x = static_cast<uint32_t>(a->i32_value);
+    auto y = static_cast<uint32_t>(b->i32_value);
+    if (i32_compare) {
+      return replace(2,
+                     makeI32Const(foldIntCompare<uint32_t>(op - 0x46, x, y)));
+    }
+    auto r = foldIntBinary<uint32_t>(op - 0x6A, x, y);
+    return r.has_value() && replace(2, makeI32Const(*r));
+  }
+  if (i64_binary || i64_compare) {
+    auto* a = constAt(2, I64);
+    auto* b = constAt(1, I64);
+    if (a == nullptr || b == nullptr) {
+      return false;
+    }
+    auto x = static_cast<uint64_t>(a->i64_value);
+    auto y = static_cast<uint64_t>(b->i64_value);
+    if (i64_compare) {
+      return replace(2,
+                     makeI32Const(foldIntCompare<uint64_t>(op - 0x51, x, y)));
+    }
+    auto r = foldIntBinary<uint64_t>(op - 0x7C, x, y);
+    return r.has_value() && replace(2, makeI64Const(*r));
+  }
+
+  if (auto* a = constAt(1, I32)) {
+    auto x = static_cast<uint32_t>(a->i32_value);
+    switch (type) {
+      case NumericInstruction::Type::I32_EQZ:
+        return replace(1, makeI32Const(x == 0));
+      case NumericInstruction::Type::I32_CLZ:
+      case NumericInstruction::Type::I32_CTZ:
+      case NumericInstruction::Type::I32_POPCNT:
+        return replace(1, makeI32Const(foldIntUnary<uint32_t>(op - 0x67, x)));
+      case NumericInstruction::Type::I64_EXTEND_I32_S:
+        return replace(1, makeI64Const(static_cast<int64_t>(a->i32_value)));
+      case NumericInstruction::Type::I64_EXTEND_I32_U:
+        return replace(1, makeI64Const(x));
+      case NumericInstruction::Type::I32_EXTEND8_S:
+        return replace(1, makeI32Const(static_cast<int8_t>(x)));
+      case NumericInstruction::Type::I32_EXTEND16_S:
+        return replace(1, makeI32Const(static_cast<int16_t>(x)));
+      default:
+        return false;
+    }
+  }
+  if (auto* a = constAt(1, I64)) {
+    auto x = static_cast<uint64_t>(a->i64_value);
+    switch (type) {
+      case NumericInstruction::Type::I64_EQZ:
+        return replace(1, makeI32Const(x == 0));
+      case NumericInstruction::Type::I64_CLZ:
+      case NumericInstruction::Type::I64_CTZ:
+      case NumericInstruction::Type::I64_POPCNT:
+        return replace(1, makeI64Const(foldIntUnary<uint64_t>(op - 0x79, x)));
+      case NumericInstruction::Type::I32_WRAP_I64:
+        return replace(1, makeI32Const(static_cast<uint32_t>(x)));
+      case NumericInstruction::Type::I64_EXTEND8_S:
+        return replace(1, makeI64Const(static_cast<int8_t>(x)));
+      case NumericInstruction::Type::I64_EXTEND16_S:
+        return replace(1, makeI64Const(static_cast<int16_t>(x)));
+      case NumericInstruction::Type::I64_EXTEND32_S:
+        return replace(1, makeI64Const(static_cast<int32_t>(x)));
+      default:
+        return false;
+    }
+  }
+  return false;
+}
+
+PeepholeStats optimizeCode(Module* m, InstructionDecoder* d) {
+  PeepholeOptimizer optimizer(m);
+  StackEffects effects(m);
+  for (size_t i = 0; i < d->cs_.size(); ++i) {
+    auto& c = d->cs_[i];
+    size_t before = optimizer.stats().total();
+    Func f = *c.code;
+    optimizer.optimize(&f);
+    if (optimizer.stats().total() != before) {
+      // Folding lowers the operand stack, so the frame is recomputed.
+      const FuncType* type = effects.funcType(
+          d->imported_func_count_ + static_cast<uint32_t>(i));
+      if (type != nullptr) {
+        effects.frame(*type, f, &f.frame);
+      }
+      c.code = std::make_shared<const Func>(std::move(f));
+    }
+  }
+  if (optimizer.stats().total() != 0) {
+    d->detachCode(m);
+  }
+  return optimizer.stats();
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_PEEPHOLE_H
@@ -0,0 +1,192 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_PROFILING_H
+#define WASMPARSER_CPP_PROFILING_H
+
+#include <string>
+#include <vector>
+
+#include "instruction_decoder.h"
+#include "module.h"
+#include "stack_effect.h"
+
+namespace wasmparser {
+
+struct ProfileOptions {
+  // Counters are exported as mutable globals named by this prefix and the
+  // counter index, so that the host can read them.
+  std::string export_prefix = "__profile_counter_";
+  // Count the iterations of every loop in addition to the calls of every
+  // function.
+  bool count_loops = true;
+};
+
+struct ProfileCounter {
+  enum class Kind : Byte {
+    // Calls of a function.
+    Func,
+    // Iterations of a loop, including the first entry.
+    Loop,
+  };
+  Kind kind;
+  uint32_t func_idx;
+  // Pre-order position of the loop among the loops of its function.
+  uint32_t loop_idx;
+  // The i64 global holding the counter.
+  uint32_t global_idx;
+};
+
+// Instruments the defined functions of `m` and `d` to count their calls and
+// loop iterations in injected mutable i64 globals, one per counter, which
+// are appended after the existing globals and exported. A counter costs a
+// global.get, an i64.const, an i64.add and a global.set at the function
+// entry or loop head. Returns the counters in the order of their globals:
+// each function is followed by its loops.
+//
+// Write the result out with ModuleWriter. As with the other transformations,
+// the raw global and code sections of `m` are cleared, and so are the code
+// offsets and the incremental decoding state of `d`.
+std::vector<ProfileCounter> instrumentProfile(
+    Module* m, InstructionDecoder* d, const ProfileOptions& options = {});
+
+namespace {
+
+// global.get idx; i64.const 1; i64.add; global.set idx
+void appendCounterIncrement(uint32_t global_idx,
+                            std::vector<Instruction>* out) {
+  Instruction i;
+  i.type = InstructionType::Variable;
+  i.variable_instruction = {VariableInstruction::Type::GLOBAL_GET, global_idx};
+  out->emplace_back(i);
+  i.type = InstructionType::NumericConst;
+  i.numeric_const_instruction.type = NumericConstInstruction::Type::I64_CONST;
+  i.numeric_const_instruction.i64_value = 1;
+  out->emplace_back(i);
+  i.type = InstructionType::Numeric;
+  i.numeric_instruction.type = NumericInstruction::Type::I64_ADD;
+  out->emplace_back(i);
+  i.type = InstructionType::Variable;
+  i.variable_instruction = {VariableInstruction::Type::GLOBAL_SET, global_idx};
+  out->emplace_back(i);
+}
+
+// Prepends an increment of a new counter to `instrs`.
+void prependCounter(ProfileCounter counter, InstructionDecoder* d,
+                    std::vector<ProfileCounter>* counters,
+                    std::vector<Instruction>* instrs) {
+  std::vector<Instruction> with_counter;
+  with_counter.reserve(4 + instrs->size());
+  appendCounterIncrement(counter.global_idx, &with_counter);
+  with_counter.insert(with_counter.end(),
+                      std::make_move_iterator(instrs->begin()),
+                      std::make_move_iterator(instrs->end()));
+  *instrs = std::move(with_counter);
+
+  Global g;
+  g.type = {ValueType::I64, GlobalType::Mutability::Var};
+  Instruction init;
+  init.type = InstructionType::NumericConst;
+  init.numeric_const_instruction.type =
+      NumericConstInstruction::Type::I64_CONST;
+  init.numeric_const_instruction.i64_value = 0;
+  g.init.emplace_back(init);
+  d->gs_.emplace_back(std::move(g));
+  counters->emplace_back(counter);
+}
+
+void instrumentLoops(uint32_t func_idx, uint32_t first_global,
+                     InstructionDecoder* d, std::vector<Instruction>* instrs,
+                     uint32_t* loop_idx,
+                     std::vector<ProfileCounter>* counters) {
+  for (auto& i : *instrs) {
+    if (i.type != InstructionType::Block) {
+      continue;
+    }
+    auto& bi = i.block_instruction;
+    if (bi.type == BlockInstruction::Type::LOOP) {
+      ProfileCounter counter{
+          ProfileCounter::Kind::Loop, func_idx, (*loop_idx)++,
+          first_global + static_cast<uint32_t>(counters->size())};
+      prependCounter(counter, d, counters, &bi.instructions);
+    }
+    instrumentLoops(func_idx, first_global, d, &bi.instructions, loop_idx,
+                    counters);
+    instrumentLoops(func_idx, first_global, d, &bi.else_instructions,
+                    loop_idx, counters);
+  }
+}
+
+}  // namespace
+
+std::vector<ProfileCounter> instrumentProfile(Module* m, InstructionDecoder* d,
+                                              const ProfileOptions& options) {
+  uint32_t first_global = m->global_space.size();
+
+  StackEffects effects(m);
+  std::vector<ProfileCounter> counters;
+  for (size_t k = 0; k < d->cs_.size(); ++k) {
+    uint32_t func_idx = d->imported_func_count_ + static_cast<uint32_t>(k);
+    auto& c = d->cs_[k];
+    Func f = *c.code;
+    ProfileCounter counter{
+        ProfileCounter::Kind::Func, func_idx, 0,
+        first_global + static_cast<uint32_t>(counters.size())};
+    prependCounter(counter, d, &counters, &f.expr);
+    if (options.count_loops) {
+      uint32_t loop_idx = 0;
+      instrumentLoops(func_idx, first_global, d, &f.expr, &loop_idx,
+                      &counters);
+    }
+    // The increment needs two more operand stack slots.
+    if (const FuncType* type = effects.funcType(func_idx)) {
+      effects.frame(*type, f, &f.frame);
+    }
+    c.code = std::make_shared<const Func>(std::move(f));
+  }
+
+  for (const auto& counter : counters) {
+    m->global_space.entries.push_back(
+        {ValueType::I64, GlobalType::Mutability::Var});
+    std::string name =
+        options.export_prefix +
+        std::to_string(counter.global_idx - first_global);
+    Export e;
+    e.name.assign(name.begin(), name.end());
+    e.desc = {Export::ExportDesc::ExportDescType::GlobalIdx,
+              counter.global_idx};
+    m->export_sec.value.emplace_back(std::move(e));
+  }
+
+  if (!counters.empty()) {
+    m->global_sec = RawBufferGlobalSection{};
+    d->detachCode(m);
+  }
+  return counters;
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_PROFILING_H
@@ -0,0 +1,233 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_SECTION_DIRECTORY_H
+#define WASMPARSER_CPP_SECTION_DIRECTORY_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "leb128.h"
+#include "module.h"
+#include "value.h"
+
+namespace wasmparser {
+namespace {
+static constexpr std::array<Byte, 4> MAGIC = {0x00, 0x61, 0x73, 0x6D};
+static constexpr std::array<Byte, 4> VERSION = {0x01, 0x00, 0x00, 0x00};
+}  // namespace
+
+struct SectionEntry {
+  SectionId id;
+  // Module offsets of the section id and of the payload.
+  size_t start;
+  size_t offset;
+  uint32_t size;
+  // Number of entries of the vector a known section starts with, or the
+  // value of a data count section. Zero for start and custom sections.
+  uint32_t count;
+  // Name of a custom section.
+  std::string name;
+
+  size_t end() const { return offset + size; }
+};
+
+// Sections of a module with their positions, as found by scanSections.
+// Unknown sections are listed too, although the parser drops them.
+struct SectionDirectory {
+  std::vector<SectionEntry> sections;
+  size_t module_size{0};
+
+  // The first section of `id`, or nullptr.
+  const SectionEntry* find(SectionId id) const;
+  // Entry count of the first section of `id`, zero when it is missing.
+  uint32_t count(SectionId id) const;
+  uint32_t importCount() const { return count(SectionId::Import); }
+  uint32_t funcCount() const { return count(SectionId::Function); }
+  uint32_t dataSegmentCount() const { return count(SectionId::Data); }
+  // Payload bytes of the data section.
+  size_t dataSize() const;
+};
+
+// Lists the sections of a module from their headers. Only the ids, sizes,
+// the leading vector counts and custom section names are read, so the
+// payloads are neither decoded nor copied, and a scan takes time in the
+// number of sections rather than the size of the module. Throws
+// std::runtime_error on a malformed header or when a section exceeds the
+// module.
+SectionDirectory scanSections(const Byte* data, size_t size);
+// Scans a file which is mapped rather than read, so that only the pages
+// holding section headers are touched.
+SectionDirectory scanSections(std::string_view filename);
+
+// Read-only mapping of a whole file.
+class MappedFile {
+ public:
+  explicit MappedFile(std::string_view filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const Byte* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const Byte* data_{nullptr};
+  size_t size_{0};
+};
+
+const SectionEntry* SectionDirectory::find(SectionId id) const {
+  for (const auto& s : sections) {
+    if (s.id == id) {
+      return &s;
+    }
+  }
+  return nullptr;
+}
+
+uint32_t SectionDirectory::count(SectionId id) const {
+  const auto* s = find(id);
+  return s != nullptr ? s->count : 0;
+}
+
+size_t SectionDirectory::dataSize() const {
+  const auto* s = find(SectionId::Data);
+  return s != nullptr ? s->size : 0;
+}
+
+namespace {
+
+// Reads a u32 LEB128 at `*idx` of a buffer of `size` bytes, without reading
+// past it.
+bool scanU32(const Byte* data, size_t size, size_t* idx, uint32_t* v) {
+  *v = 0;
+  for (uint32_t shift = 0; shift < 35; shift += 7) {
+    if (*idx >= size) {
+      return false;
+    }
+    Byte b = data[(*idx)++];
+    *v |= static_cast<uint32_t>(b & 0x7F) << shift;
+    if ((b & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+SectionDirectory scanSections(const Byte* data, size_t size) {
+  if (size < 8 || std::memcmp(data, MAGIC.data(), MAGIC.size()) != 0) {
+    throw std::runtime_error("Invalid magic number");
+  }
+  if (std::memcmp(data + MAGIC.size(), VERSION.data(), VERSION.size()) != 0) {
+    throw std::runtime_error("Invalid version number");
+  }
+  SectionDirectory dir;
+  dir.module_size = size;
+  size_t idx = 8;
+  while (idx < size) {
+    SectionEntry s;
+    s.start = idx;
+    s.id = static_cast<SectionId>(data[idx++]);
+    if (!scanU32(data, size, &idx, &s.size) || s.size > size - idx) {
+      throw std::runtime_error("Failed to scan sections");
+    }
+    s.offset = idx;
+    s.count = 0;
+    size_t payload = idx;
+    switch (s.id) {
+      case SectionId::Custom: {
+        uint32_t name_size;
+        if (!scanU32(data, s.end(), &payload, &name_size) ||
+            name_size > s.end() - payload) {
+          throw std::runtime_error("Failed to scan sections");
+        }
+        s.name.assign(reinterpret_cast<const char*>(data + payload),
+                      name_size);
+        break;
+      }
+      case SectionId::Start:
+        break;
+      default:
+        if (static_cast<Byte>(s.id) <=
+                static_cast<Byte>(SectionId::DataCount) &&
+            !scanU32(data, s.end(), &payload, &s.count)) {
+          throw std::runtime_error("Failed to scan sections");
+        }
+        break;
+    }
+    idx = s.end();
+    dir.sections.emplace_back(std::move(s));
+  }
+  return dir;
+}
+
+SectionDirectory scanSections(std::string_view filename) {
+  MappedFile file(filename);
+  return scanSections(file.data(), file.size());
+}
+
+MappedFile::MappedFile(std::string_view filename) {
+  int fd = ::open(std::string(filename).c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open file.");
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Failed to check file stats.");
+  }
+  size_ = st.st_size;
+  if (size_ != 0) {
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("Failed to map file.");
+    }
+    data_ = static_cast<const Byte*>(p);
+  }
+  // The mapping stays valid without the descriptor.
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    ::munmap(const_cast<Byte*>(data_), size_);
+  }
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_SECTION_DIRECTORY_H
@@ -0,0 +1,196 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_SMALL_VECTOR_H
+#define WASMPARSER_CPP_SMALL_VECTOR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace wasmparser {
+
+// Vector of trivially copyable elements which keeps up to N of them inline,
+// so that the short vectors of result types, locals and br_table labels
+// don't allocate. Larger vectors move to the heap like std::vector. The
+// size and capacity are 32 bits wide, as wasm vectors are, which keeps the
+// header of a SmallVector<uint32_t, 2> as small as a std::vector.
+template <class T, uint32_t N>
+class SmallVector {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "SmallVector copies its elements bytewise");
+
+ public:
+  using value_type = T;
+  using size_type = size_t;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  SmallVector() = default;
+  SmallVector(std::initializer_list<T> init) {
+    assign(init.begin(), init.end());
+  }
+  template <class It>
+  SmallVector(It first, It last) {
+    assign(first, last);
+  }
+  SmallVector(const SmallVector& o) { assign(o.begin(), o.end()); }
+  SmallVector(SmallVector&& o) noexcept { steal(&o); }
+  ~SmallVector() { ::operator delete(heap_); }
+
+  SmallVector& operator=(const SmallVector& o) {
+    if (this != &o) {
+      assign(o.begin(), o.end());
+    }
+    return *this;
+  }
+  SmallVector& operator=(SmallVector&& o) noexcept {
+    if (this != &o) {
+      ::operator delete(heap_);
+      heap_ = nullptr;
+      steal(&o);
+    }
+    return *this;
+  }
+
+  T* data() { return heap_ != nullptr ? heap_ : inline_; }
+  const T* data() const { return heap_ != nullptr ? heap_ : inline_; }
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+  // Whether the elements are stored inline, without a heap allocation.
+  bool isInline() const { return heap_ == nullptr; }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + size_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+
+  T& operator[](size_t i) { return data()[i]; }
+  const T& operator[](size_t i) const { return data()[i]; }
+  T& front() { return data()[0]; }
+  const T& front() const { return data()[0]; }
+  T& back() { return data()[size_ - 1]; }
+  const T& back() const { return data()[size_ - 1]; }
+
+  void reserve(size_t capacity) {
+    if (capacity > capacity_) {
+      grow(capacity);
+    }
+  }
+  void resize(size_t size) {
+    reserve(size);
+    if (size > size_) {
+      std::fill(data() + size_, data() + size, T{});
+    }
+    size_ = static_cast<uint32_t>(size);
+  }
+  void clear() { size_ = 0; }
+
+  void push_back(const T& v) {
+    if (size_ == capacity_) {
+      // `v` may refer to an element, so it is copied before growing.
+      T copy = v;
+      grow(static_cast<size_t>(capacity_) * 2);
+      data()[size_++] = copy;
+      return;
+    }
+    data()[size_++] = v;
+  }
+  template <class... Args>
+  T& emplace_back(Args&&... args) {
+    push_back(T{std::forward<Args>(args)...});
+    return back();
+  }
+  void pop_back() { --size_; }
+
+  template <class It>
+  void assign(It first, It last) {
+    size_t n = std::distance(first, last);
+    clear();
+    reserve(n);
+    std::copy(first, last, data());
+    size_ = static_cast<uint32_t>(n);
+  }
+  // Inserts [first, last) before `pos`.
+  template <class It>
+  iterator insert(const_iterator pos, It first, It last) {
+    size_t offset = pos - begin();
+    size_t n = std::distance(first, last);
+    reserve(size_ + n);
+    T* p = data() + offset;
+    std::memmove(p + n, p, (size_ - offset) * sizeof(T));
+    std::copy(first, last, p);
+    size_ += static_cast<uint32_t>(n);
+    return p;
+  }
+
+  bool operator==(const SmallVector& o) const {
+    return size_ == o.size_ && std::equal(begin(), end(), o.begin());
+  }
+  bool operator!=(const SmallVector& o) const { return !(*this == o); }
+
+ private:
+  void grow(size_t capacity) {
+    if (capacity > std::numeric_limits<uint32_t>::max()) {
+      throw std::bad_alloc();
+    }
+    // Through operator new, like std::vector, so that replacing it sees
+    // these allocations too.
+    auto* p = static_cast<T*>(::operator new(capacity * sizeof(T)));
+    std::memcpy(p, data(), size_ * sizeof(T));
+    ::operator delete(heap_);
+    heap_ = p;
+    capacity_ = static_cast<uint32_t>(capacity);
+  }
+  void steal(SmallVector* o) {
+    if (o->heap_ != nullptr) {
+      heap_ = o->heap_;
+      capacity_ = o->capacity_;
+    } else {
+      std::memcpy(inline_, o->inline_, o->size_ * sizeof(T));
+      capacity_ = N;
+    }
+    size_ = o->size_;
+    o->heap_ = nullptr;
+    o->size_ = 0;
+    o->capacity_ = N;
+  }
+
+  T* heap_{nullptr};
+  uint32_t size_{0};
+  uint32_t capacity_{N};
+  T inline_[N];
+};
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_SMALL_VECTOR_H
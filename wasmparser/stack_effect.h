@@ -0,0 +1,374 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_STACK_EFFECT_H
+#define WASMPARSER_CPP_STACK_EFFECT_H
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "module.h"
+#include "small_vector.h"
+
+namespace wasmparser {
+
+// Operand stack change of an instruction.
+struct StackEffect {
+  uint32_t pops;
+  uint32_t pushes;
+};
+
+// Stack effects of the instructions of a module. Calls and blocks with a
+// type index need the module's types; without a module their effects are
+// unknown.
+class StackEffects {
+ public:
+  explicit StackEffects(const Module* m = nullptr);
+
+  // Effect of `i`, or nullopt when it is unknown or the stack is
+  // polymorphic afterwards, as after br, br_table, return and unreachable.
+  // A block pops its params, and an if also its condition.
+  std::optional<StackEffect> of(const Instruction& i) const;
+  // Params and results of a block.
+  std::optional<StackEffect> blockArity(const BlockInstruction& bi) const;
+  const FuncType* funcType(uint32_t func_idx) const;
+  // Computes the frame of `f` whose type is `type`, reusing the storage of
+  // `frame`, e.g. of a recycled body. Fails when the number of locals
+  // overflows, when an effect is unknown or when the operand stack
+  // underflows.
+  bool frame(const FuncType& type, const Func& f, Func::Frame* frame) const;
+
+ private:
+  // Walks `expr` and raises `max` to the highest height on the way. Nested
+  // blocks are walked with an explicit stack, as they may nest deeper than
+  // the native stack allows.
+  bool maxHeight(const std::vector<Instruction>& expr, uint32_t* max) const;
+  static StackEffect simdEffect(uint32_t op);
+  static StackEffect atomicEffect(uint32_t op);
+
+  const Module* m_;
+};
+
+StackEffects::StackEffects(const Module* m) : m_(m) {}
+
+const FuncType* StackEffects::funcType(uint32_t func_idx) const {
+  if (m_ == nullptr || func_idx >= m_->func_space.size() ||
+      m_->func_space[func_idx] >= m_->type_sec.value.size()) {
+    return nullptr;
+  }
+  return &m_->type_sec.value[m_->func_space[func_idx]];
+}
+
+bool StackEffects::frame(const FuncType& type, const Func& f,
+                         Func::Frame* frame) const {
+  Func::Frame fr;
+  reuseStorage(&frame->slots, &fr.slots);
+  uint64_t count = 0;
+  auto add_slot = [&](ValueType t, uint32_t n) {
+    if (n == 0) {
+      return;
+    }
+    uint64_t size = t == ValueType::V128                         ? 16
+                    : t == ValueType::I64 || t == ValueType::F64 ? 8
+                                                                 : 4;
+    if (!fr.slots.empty() && fr.slots.back().t == t) {
+      fr.slots.back().n += n;
+    } else {
+      uint64_t offset = (fr.locals_size + size - 1) / size * size;
+      fr.slots.push_back({t, static_cast<uint32_t>(count), n, offset});
+      fr.locals_size = offset;
+    }
+    fr.locals_size += n * size;
+    count += n;
+  };
+  for (auto t : type.param_type) {
+    add_slot(t, 1);
+  }
+  for (const auto& l : f.locals) {
+    if (count + l.n > std::numeric_limits<uint32_t>::max()) {
+      return false;
+    }
+    add_slot(l.t, l.n);
+  }
+  fr.local_count = static_cast<uint32_t>(count);
+  if (!maxHeight(f.expr, &fr.max_stack_height)) {
+    return false;
+  }
+  *frame = std::move(fr);
+  return true;
+}
+
+bool StackEffects::maxHeight(const std::vector<Instruction>& expr,
+                             uint32_t* max) const {
+  // A sequence which starts at `height` values, of which `floor` belong to
+  // enclosing blocks.
+  struct Sequence {
+    const std::vector<Instruction>* instrs;
+    size_t next;
+    uint32_t floor;
+    uint32_t height;
+  };
+  SmallVector<Sequence, 16> open;
+  open.push_back({&expr, 0, 0, 0});
+  while (!open.empty()) {
+    Sequence& seq = open.back();
+    if (seq.next == seq.instrs->size()) {
+      open.pop_back();
+      continue;
+    }
+    const auto& i = (*seq.instrs)[seq.next++];
+    auto effect = of(i);
+    if (!effect.has_value()) {
+      bool polymorphic =
+          i.type == InstructionType::SingleOperandControl ||
+          i.type == InstructionType::Branch ||
+          i.type == InstructionType::TableBranch;
+      if (!polymorphic) {
+        return false;
+      }
+      // The rest of the sequence is unreachable, and whatever it pushes
+      // stays below what reachable code pushes.
+      open.pop_back();
+      continue;
+    }
+    if (seq.height - seq.floor < effect->pops) {
+      return false;
+    }
+    uint32_t height = seq.height;
+    seq.height = height - effect->pops + effect->pushes;
+    *max = std::max(*max, seq.height);
+    if (i.type == InstructionType::Block) {
+      const auto& bi = i.block_instruction;
+      uint32_t params = blockArity(bi)->pops;
+      // Without the condition of an if.
+      uint32_t start = height - (effect->pops - params);
+      // Walked before the rest of the enclosing sequence, which `seq` no
+      // longer refers to once these are pushed.
+      open.push_back({&bi.else_instructions, 0, start - params, start});
+      open.push_back({&bi.instructions, 0, start - params, start});
+    }
+  }
+  return true;
+}
+
+std::optional<StackEffect> StackEffects::blockArity(
+    const BlockInstruction& bi) const {
+  switch (bi.block_type) {
+    case BlockInstruction::BlockType::Empty:
+      return StackEffect{0, 0};
+    case BlockInstruction::BlockType::ValueType:
+      return StackEffect{0, 1};
+    case BlockInstruction::BlockType::TypeIndex:
+      if (m_ == nullptr || bi.type_idx < 0 ||
+          static_cast<uint64_t>(bi.type_idx) >= m_->type_sec.value.size()) {
+        return std::nullopt;
+      }
+      const auto& ft = m_->type_sec.value[bi.type_idx];
+      return StackEffect{static_cast<uint32_t>(ft.param_type.size()),
+                         static_cast<uint32_t>(ft.return_type.size())};
+  }
+  return std::nullopt;
+}
+
+std::optional<StackEffect> StackEffects::of(const Instruction& i) const {
+  switch (i.type) {
+    case InstructionType::SingleOperandControl:
+      if (i.single_operand_control_instruction.type ==
+          SingleOperandControlInstruction::Type::NOP) {
+        return StackEffect{0, 0};
+      }
+      return std::nullopt;
+    case InstructionType::Block: {
+      auto arity = blockArity(i.block_instruction);
+      if (arity.has_value() &&
+          i.block_instruction.type == BlockInstruction::Type::IF) {
+        ++arity->pops;
+      }
+      return arity;
+    }
+    case InstructionType::Branch:
+      if (i.branch_instruction.type == BranchInstruction::Type::BR_IF) {
+        return StackEffect{1, 0};
+      }
+      return std::nullopt;
+    case InstructionType::TableBranch:
+      return std::nullopt;
+    case InstructionType::Call: {
+      const FuncType* ft = nullptr;
+      uint32_t extra = 0;
+      if (i.call_instruction.type == CallInstruction::Type::CALL) {
+        ft = funcType(i.call_instruction.index);
+      } else if (m_ != nullptr &&
+                 i.call_instruction.index < m_->type_sec.value.size()) {
+        ft = &m_->type_sec.value[i.call_instruction.index];
+        // The table element index.
+        extra = 1;
+      }
+      if (ft == nullptr) {
+        return std::nullopt;
+      }
+      return StackEffect{static_cast<uint32_t>(ft->param_type.size()) + extra,
+                         static_cast<uint32_t>(ft->return_type.size())};
+    }
+    case InstructionType::Parametric:
+      if (i.parametric_instruction.type == ParametricInstruction::Type::DROP) {
+        return StackEffect{1, 0};
+      }
+      return StackEffect{3, 1};
+    case InstructionType::Variable:
+      switch (i.variable_instruction.type) {
+        case VariableInstruction::Type::LOCAL_GET:
+        case VariableInstruction::Type::GLOBAL_GET:
+          return StackEffect{0, 1};
+        case VariableInstruction::Type::LOCAL_SET:
+        case VariableInstruction::Type::GLOBAL_SET:
+          return StackEffect{1, 0};
+        case VariableInstruction::Type::LOCAL_TEE:
+          return StackEffect{1, 1};
+      }
+      return std::nullopt;
+    case InstructionType::BasicMemory:
+      // Loads are 0x28 to 0x35, stores 0x36 to 0x3E.
+      if (static_cast<Byte>(i.basic_memory_instruction.type) <= 0x35) {
+        return StackEffect{1, 1};
+      }
+      return StackEffect{2, 0};
+    case InstructionType::MemorySize:
+      if (i.memory_size_instruction.type ==
+          MemorySizeInstruction::Type::MEMORY_SIZE) {
+        return StackEffect{0, 1};
+      }
+      return StackEffect{1, 1};
+    case InstructionType::NumericConst:
+      return StackEffect{0, 1};
+    case InstructionType::Numeric: {
+      auto op = static_cast<Byte>(i.numeric_instruction.type);
+      bool unary = op == 0x45 || op == 0x50 || (0x67 <= op && op <= 0x69) ||
+                   (0x79 <= op && op <= 0x7B) || (0x8B <= op && op <= 0x91) ||
+                   (0x99 <= op && op <= 0x9F) || op >= 0xA7;
+      return unary ? StackEffect{1, 1} : StackEffect{2, 1};
+    }
+    case InstructionType::Simd:
+      return simdEffect(static_cast<uint32_t>(i.simd_instruction.type));
+    case InstructionType::SimdConst:
+      return StackEffect{0, 1};
+    case InstructionType::SimdShuffle:
+      return StackEffect{2, 1};
+    case InstructionType::SaturatingTruncation:
+      return StackEffect{1, 1};
+    case InstructionType::BulkMemory:
+      switch (i.bulk_memory_instruction.type) {
+        case BulkMemoryInstruction::Type::DATA_DROP:
+        case BulkMemoryInstruction::Type::ELEM_DROP:
+          return StackEffect{0, 0};
+        case BulkMemoryInstruction::Type::TABLE_GROW:
+          return StackEffect{2, 1};
+        case BulkMemoryInstruction::Type::TABLE_SIZE:
+          return StackEffect{0, 1};
+        default:
+          return StackEffect{3, 0};
+      }
+    case InstructionType::Atomic:
+      return atomicEffect(static_cast<uint32_t>(i.atomic_instruction.type));
+  }
+  return std::nullopt;
+}
+
+StackEffect StackEffects::simdEffect(uint32_t op) {
+  if (op <= 0x0A || (0x5C <= op && op <= 0x5D)) {
+    // Loads.
+    return {1, 1};
+  }
+  if (op == 0x0B || (0x58 <= op && op <= 0x5B)) {
+    // v128.store and store lane.
+    return {2, 0};
+  }
+  if ((0x0F <= op && op <= 0x14) || op == 0x4D || op == 0x53 ||
+      op == 0x5E || op == 0x5F) {
+    // Splats, not, any_true, demote and promote.
+    return {1, 1};
+  }
+  if (0x15 <= op && op <= 0x22) {
+    // Lanes are extracted by 0x15, 0x16, 0x18, 0x19, 0x1B, 0x1D, 0x1F and
+    // 0x21 and replaced by the others.
+    bool extract = op == 0x15 || op == 0x16 || op == 0x18 || op == 0x19 ||
+                   op == 0x1B || op == 0x1D || op == 0x1F || op == 0x21;
+    return extract ? StackEffect{1, 1} : StackEffect{2, 1};
+  }
+  if (op == 0x52) {
+    // bitselect.
+    return {3, 1};
+  }
+  if (op < 0x60) {
+    // swizzle, comparisons, bitwise operations and load lane.
+    return {2, 1};
+  }
+  // abs, neg, popcnt, all_true, bitmask, rounding, extadd_pairwise,
+  // extend, sqrt and conversions are unary. Everything else is binary,
+  // including shifts by an i32.
+  bool unary = (0x60 <= op && op <= 0x64) || (0x67 <= op && op <= 0x6A) ||
+               op == 0x74 || op == 0x75 || op == 0x7A ||
+               (0x7C <= op && op <= 0x81) || op == 0x83 || op == 0x84 ||
+               (0x87 <= op && op <= 0x8A) || op == 0x94 || op == 0xA0 ||
+               op == 0xA1 || op == 0xA3 || op == 0xA4 ||
+               (0xA7 <= op && op <= 0xAA) || op == 0xC0 || op == 0xC1 ||
+               op == 0xC3 || op == 0xC4 || (0xC7 <= op && op <= 0xCA) ||
+               op == 0xE0 || op == 0xE1 || op == 0xE3 || op == 0xEC ||
+               op == 0xED || op == 0xEF || op >= 0xF8;
+  return unary ? StackEffect{1, 1} : StackEffect{2, 1};
+}
+
+StackEffect StackEffects::atomicEffect(uint32_t op) {
+  if (op == 0x00) {
+    // memory.atomic.notify.
+    return {2, 1};
+  }
+  if (op == 0x01 || op == 0x02) {
+    // memory.atomic.wait32 and wait64.
+    return {3, 1};
+  }
+  if (op == 0x03) {
+    // atomic.fence.
+    return {0, 0};
+  }
+  if (op <= 0x16) {
+    return {1, 1};
+  }
+  if (op <= 0x1D) {
+    return {2, 0};
+  }
+  if (op <= 0x47) {
+    // Read-modify-write operations.
+    return {2, 1};
+  }
+  // cmpxchg.
+  return {3, 1};
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_STACK_EFFECT_H
@@ -0,0 +1,328 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_STATIC_PARSER_H
+#define WASMPARSER_CPP_STATIC_PARSER_H
+
+#include <array>
+#include <stdexcept>
+
+#include "leb128.h"
+#include "types.h"
+
+namespace wasmparser {
+
+// Index of a module which is embedded in the binary as a byte array. It
+// holds no copies of the module, only offsets into the array, so it fits
+// into fixed-size tables which can be built in a constant expression.
+template <size_t MaxEntries>
+struct StaticModuleIndex {
+  struct Span {
+    uint32_t offset;
+    uint32_t size;
+  };
+  struct FuncType {
+    // Value types are single bytes, so they are read from the module itself.
+    Span params;
+    Span results;
+  };
+  struct Import {
+    Span module_name;
+    Span name;
+    Byte kind;
+    // Type index for function imports, zero otherwise.
+    uint32_t type_idx;
+  };
+  struct Export {
+    Span name;
+    Byte kind;
+    uint32_t idx;
+  };
+
+  std::array<FuncType, MaxEntries> types{};
+  size_t type_count{0};
+  std::array<Import, MaxEntries> imports{};
+  size_t import_count{0};
+  std::array<Export, MaxEntries> exports{};
+  size_t export_count{0};
+  // Type index and body of each defined function, in code section order.
+  std::array<uint32_t, MaxEntries> func_types{};
+  std::array<Span, MaxEntries> bodies{};
+  size_t func_count{0};
+  uint32_t imported_func_count{0};
+
+  // Body of the function at `func_idx` in the function index space.
+  constexpr Span bodyOf(uint32_t func_idx) const {
+    if (func_idx < imported_func_count ||
+        func_idx - imported_func_count >= func_count) {
+      throw std::out_of_range("Not a defined function index");
+    }
+    return bodies[func_idx - imported_func_count];
+  }
+};
+
+namespace {
+
+// Bounds checked cursor over an embedded module. Every failure throws, so a
+// malformed module aborts constant evaluation and therefore the build.
+template <size_t N>
+class StaticReader {
+ public:
+  constexpr explicit StaticReader(const std::array<Byte, N>& buf)
+      : buf_(buf) {}
+
+  constexpr size_t pos() const { return pos_; }
+  constexpr bool isEnd() const { return pos_ >= N; }
+
+  constexpr Byte readByte() {
+    if (pos_ >= N) {
+      throw std::runtime_error("Unexpected end of module");
+    }
+    return buf_[pos_++];
+  }
+
+  constexpr uint32_t readU32() {
+    uint32_t v = 0;
+    size_t len = decodeULEB128(buf_.data() + pos_, N - pos_, &v);
+    if (len == 0) {
+      throw std::runtime_error("Invalid LEB128 integer");
+    }
+    pos_ += len;
+    return v;
+  }
+
+  constexpr uint64_t readU64() {
+    uint64_t v = 0;
+    size_t len = decodeULEB128(buf_.data() + pos_, N - pos_, &v);
+    if (len == 0) {
+      throw std::runtime_error("Invalid LEB128 integer");
+    }
+    pos_ += len;
+    return v;
+  }
+
+  template <size_t MaxEntries>
+  constexpr typename StaticModuleIndex<MaxEntries>::Span readName() {
+    uint32_t size = readU32();
+    return readSpan<MaxEntries>(size);
+  }
+
+  template <size_t MaxEntries>
+  constexpr typename StaticModuleIndex<MaxEntries>::Span readSpan(
+      uint32_t size) {
+    if (size > N - pos_) {
+      throw std::runtime_error("Out of bounds vector");
+    }
+    typename StaticModuleIndex<MaxEntries>::Span s{
+        static_cast<uint32_t>(pos_), size};
+    pos_ += size;
+    return s;
+  }
+
+  template <size_t MaxEntries>
+  constexpr typename StaticModuleIndex<MaxEntries>::Span readResultType() {
+    uint32_t count = readU32();
+    typename StaticModuleIndex<MaxEntries>::Span s{
+        static_cast<uint32_t>(pos_), count};
+    for (uint32_t i = 0; i < count; ++i) {
+      readValueType();
+    }
+    return s;
+  }
+
+  constexpr void readValueType() {
+    auto b = readByte();
+    if (b != static_cast<Byte>(ValueType::I32) &&
+        b != static_cast<Byte>(ValueType::I64) &&
+        b != static_cast<Byte>(ValueType::F32) &&
+        b != static_cast<Byte>(ValueType::F64) &&
+        b != static_cast<Byte>(ValueType::V128)) {
+      throw std::runtime_error("Invalid value type");
+    }
+  }
+
+  constexpr void readLimits() {
+    auto flag = readByte();
+    // Shared memories must declare a maximum.
+    if (flag > 0x07 || (flag & 0x03) == 0x02) {
+      throw std::runtime_error("Invalid limits");
+    }
+    // Flag bit 0x04 marks the u64 limits of memory64 memories.
+    bool is64 = (flag & 0x04) != 0;
+    for (int i = 0; i < ((flag & 0x01) != 0 ? 2 : 1); ++i) {
+      if (is64) {
+        readU64();
+      } else {
+        readU32();
+      }
+    }
+  }
+
+  constexpr void skip(uint32_t size) {
+    if (size > N - pos_) {
+      throw std::runtime_error("Out of bounds section");
+    }
+    pos_ += size;
+  }
+
+ private:
+  const std::array<Byte, N>& buf_;
+  size_t pos_{0};
+};
+
+template <size_t MaxEntries>
+constexpr size_t checkedCount(uint32_t count) {
+  if (count > MaxEntries) {
+    throw std::length_error("Too many entries for StaticModuleIndex");
+  }
+  return count;
+}
+
+}  // namespace
+
+// Parses the sections needed to index an embedded module: types, imports,
+// functions, exports and code. Other sections are only skipped over. Use it
+// to initialize a constexpr variable, e.g.
+//
+//   constexpr auto index = parseStatic<16>(kFilter);
+template <size_t MaxEntries, size_t N>
+constexpr StaticModuleIndex<MaxEntries> parseStatic(
+    const std::array<Byte, N>& buf) {
+  using Index = StaticModuleIndex<MaxEntries>;
+  Index index;
+  StaticReader<N> r(buf);
+
+  constexpr std::array<Byte, 8> header = {0x00, 0x61, 0x73, 0x6D,
+                                          0x01, 0x00, 0x00, 0x00};
+  for (size_t i = 0; i < header.size(); ++i) {
+    if (r.readByte() != header[i]) {
+      throw std::runtime_error("Invalid module header");
+    }
+  }
+
+  size_t defined_funcs = 0;
+  while (!r.isEnd()) {
+    auto id = r.readByte();
+    auto size = r.readU32();
+    auto end = r.pos() + size;
+    if (size > N - r.pos()) {
+      throw std::runtime_error("Out of bounds section");
+    }
+    switch (id) {
+      case 0x01: {
+        index.type_count = checkedCount<MaxEntries>(r.readU32());
+        for (size_t i = 0; i < index.type_count; ++i) {
+          if (r.readByte() != 0x60) {
+            throw std::runtime_error("Invalid function type");
+          }
+          auto& ft = index.types[i];
+          ft.params = r.template readResultType<MaxEntries>();
+          ft.results = r.template readResultType<MaxEntries>();
+        }
+        break;
+      }
+      case 0x02: {
+        index.import_count = checkedCount<MaxEntries>(r.readU32());
+        for (size_t i = 0; i < index.import_count; ++i) {
+          auto& ip = index.imports[i];
+          ip.module_name = r.template readName<MaxEntries>();
+          ip.name = r.template readName<MaxEntries>();
+          ip.kind = r.readByte();
+          switch (ip.kind) {
+            case 0x00:
+              ip.type_idx = r.readU32();
+              ++index.imported_func_count;
+              break;
+            case 0x01:
+              if (r.readByte() != 0x70) {
+                throw std::runtime_error("Invalid element type");
+              }
+              r.readLimits();
+              break;
+            case 0x02:
+              r.readLimits();
+              break;
+            case 0x03:
+              r.readValueType();
+              if (r.readByte() > 0x01) {
+                throw std::runtime_error("Invalid mutability");
+              }
+              break;
+            default:
+              throw std::runtime_error("Invalid import kind");
+          }
+        }
+        break;
+      }
+      case 0x03: {
+        index.func_count = checkedCount<MaxEntries>(r.readU32());
+        for (size_t i = 0; i < index.func_count; ++i) {
+          index.func_types[i] = r.readU32();
+          if (index.func_types[i] >= index.type_count) {
+            throw std::runtime_error("Invalid type index");
+          }
+        }
+        break;
+      }
+      case 0x07: {
+        index.export_count = checkedCount<MaxEntries>(r.readU32());
+        for (size_t i = 0; i < index.export_count; ++i) {
+          auto& e = index.exports[i];
+          e.name = r.template readName<MaxEntries>();
+          e.kind = r.readByte();
+          if (e.kind > 0x03) {
+            throw std::runtime_error("Invalid export kind");
+          }
+          e.idx = r.readU32();
+        }
+        break;
+      }
+      case 0x0a: {
+        defined_funcs = checkedCount<MaxEntries>(r.readU32());
+        if (defined_funcs != index.func_count) {
+          throw std::runtime_error("Function and code section mismatch");
+        }
+        for (size_t i = 0; i < defined_funcs; ++i) {
+          index.bodies[i] = r.template readSpan<MaxEntries>(r.readU32());
+        }
+        break;
+      }
+      default:
+        r.skip(size);
+        break;
+    }
+    if (r.pos() != end) {
+      throw std::runtime_error("Section size mismatch");
+    }
+  }
+  if (defined_funcs != index.func_count) {
+    throw std::runtime_error("Function and code section mismatch");
+  }
+  return index;
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_STATIC_PARSER_H
@@ -0,0 +1,104 @@
+// MIT License
+//
+// Copyright (c) Rei Shimizu 2020
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+//        of this software and associated documentation files (the "Software"),
+//        to deal
+// in the Software without restriction, including without limitation the rights
+//        to use, copy, modify, merge, publish, distribute, sublicense, and/or
+//        sell copies of the Software, and to permit persons to whom the
+//        Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all
+//        copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//        AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef WASMPARSER_CPP_TYPE_REGISTRY_H
+#define WASMPARSER_CPP_TYPE_REGISTRY_H
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "hash.h"
+#include "types.h"
+
+namespace wasmparser {
+
+// Hash-conses function types into dense canonical ids: two types get the
+// same id exactly when they are structurally identical, so signatures are
+// compared as integers. Each distinct type is stored once. A registry can
+// be shared by modules, e.g. TypeRegistry::global(), to compare signatures
+// across them at link time.
+class TypeRegistry {
+ public:
+  // Process-wide registry. Types are never released from it.
+  static TypeRegistry& global();
+
+  uint32_t intern(const FuncType& ft);
+  // The type of a canonical id. References stay valid as long as the
+  // registry.
+  const FuncType& type(uint32_t id);
+  size_t size();
+  // Hash of the structure of `ft`, equal for identical types.
+  static uint64_t hashType(const FuncType& ft);
+
+ private:
+
+  std::mutex mutex_;
+  // A deque, so that references survive growth.
+  std::deque<FuncType> types_;
+  std::unordered_multimap<uint64_t, uint32_t> ids_;
+};
+
+TypeRegistry& TypeRegistry::global() {
+  static TypeRegistry registry;
+  return registry;
+}
+
+uint64_t TypeRegistry::hashType(const FuncType& ft) {
+  uint64_t h = hashBytes(reinterpret_cast<const Byte*>(ft.param_type.data()),
+                         ft.param_type.size());
+  return combineHash(
+      h, hashBytes(reinterpret_cast<const Byte*>(ft.return_type.data()),
+                   ft.return_type.size()));
+}
+
+uint32_t TypeRegistry::intern(const FuncType& ft) {
+  uint64_t hash = hashType(ft);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto range = ids_.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (types_[it->second] == ft) {
+      return it->second;
+    }
+  }
+  auto id = static_cast<uint32_t>(types_.size());
+  types_.emplace_back(ft);
+  ids_.emplace(hash, id);
+  return id;
+}
+
+const FuncType& TypeRegistry::type(uint32_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return types_.at(id);
+}
+
+size_t TypeRegistry::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return types_.size();
+}
+
+}  // namespace wasmparser
+
+#endif  // WASMPARSER_CPP_TYPE_REGISTRY_H
@@ -29,6 +29,7 @@
 #include <optional>
 #include <vector>
 
+#include "small_vector.h"
 #include "value.h"
 
 namespace wasmparser {
@@ -38,22 +39,51 @@ enum class ValueType : Byte {
   I64 = 0x7E,
   F32 = 0x7D,
   F64 = 0x7C,
+  V128 = 0x7B,
 };
 
-using ResultType = std::vector<ValueType>;
+// Most function types have a handful of params and results, which are kept
+// inline.
+using ResultType = SmallVector<ValueType, 8>;
 
 struct FuncType {
   ResultType param_type;
   ResultType return_type;
+
+  bool operator==(const FuncType& o) const {
+    return param_type == o.param_type && return_type == o.return_type;
+  }
+  bool operator!=(const FuncType& o) const { return !(*this == o); }
 };
 
 struct Limit {
-  uint32_t min_;
-  std::optional<uint32_t> max_;
+  // 64 bits wide to hold the limits of memory64 memories. Limits of 32-bit
+  // memories and tables always fit in 32 bits.
+  uint64_t min_;
+  std::optional<uint64_t> max_;
+  // Shared memories of the threads proposal.
+  bool shared = false;
+  // Memories indexed with i64 of the memory64 proposal.
+  bool is64 = false;
+
+  bool operator==(const Limit& o) const {
+    return min_ == o.min_ && max_ == o.max_ && shared == o.shared &&
+           is64 == o.is64;
+  }
+  bool operator!=(const Limit& o) const { return !(*this == o); }
 };
 
 struct MemoryType {
   Limit limit;
+
+  bool isShared() const { return limit.shared; }
+  // Type of addresses and memory.size/memory.grow operands.
+  ValueType indexType() const {
+    return limit.is64 ? ValueType::I64 : ValueType::I32;
+  }
+
+  bool operator==(const MemoryType& o) const { return limit == o.limit; }
+  bool operator!=(const MemoryType& o) const { return !(*this == o); }
 };
 
 struct GlobalType {
@@ -64,11 +94,21 @@ struct GlobalType {
 
   ValueType val_type;
   Mutability mut;
+
+  bool operator==(const GlobalType& o) const {
+    return val_type == o.val_type && mut == o.mut;
+  }
+  bool operator!=(const GlobalType& o) const { return !(*this == o); }
 };
 
 struct TableType {
   Byte elem_type = 0x70;
   Limit limit;
+
+  bool operator==(const TableType& o) const {
+    return elem_type == o.elem_type && limit == o.limit;
+  }
+  bool operator!=(const TableType& o) const { return !(*this == o); }
 };
 
 }  // namespace wasmparser
@@ -26,6 +26,7 @@
 #ifndef WASMPARSER_CPP_VALUE_H
 #define WASMPARSER_CPP_VALUE_H
 
+#include <array>
 #include <vector>
 
 namespace wasmparser {
@@ -33,6 +34,7 @@ namespace wasmparser {
 using Byte = unsigned char;
 using Name = std::vector<Byte>;
 using Bytes = std::vector<Byte>;
+using V128 = std::array<Byte, 16>;
 
 }  // namespace wasmparser
 